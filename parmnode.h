@@ -0,0 +1,72 @@
+//----------------------------------------------------------------------
+//                         parm parser
+//
+// Layout of parsed nodes, for code that walks them directly (such as
+// the C++ API in parmparser.hpp) instead of through the cursor kept in
+// the handle.
+//
+// Parsed nodes live in one arena and refer to each other by 32-bit
+// offsets into it (offset 0 means none). Keys and values shorter than
+// PRMP_INLINE_SIZE are kept right in the node. Otherwise the slot holds
+// the string's offset and its last byte is tagged (an inline string
+// always has its NUL there). Values with escapes or ${} references are
+// kept raw and tagged, and decoded the first time someone asks; use
+// parmNodeValue() for those...
+//----------------------------------------------------------------------
+#ifndef PARMNODE_H_
+#define PARMNODE_H_
+ 
+#include <stdint.h>
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+ 
+#define PRMP_INLINE_SIZE  8
+#define PRMP_SLOT_OOL     0x80            // Slot tag: string is out of line.
+#define PRMP_SLOT_ESC     0x01            // Has \ escapes (double quoted).
+#define PRMP_SLOT_INTERP  0x02            // Has ${} references.
+#define PRMP_SLOT_MEMO    0x04            // Decoded; off indexes handle memo.
+#define PRMP_SLOT_BUSY    0x08            // Being decoded (cycle check).
+#define PRMP_SLOT_CYCLE   0x10            // Refers back to itself; published as "".
+#define PRMP_SLOT_LAZY    (PRMP_SLOT_ESC | PRMP_SLOT_INTERP | PRMP_SLOT_MEMO)
+#define PRMP_TYPE_MASK    3u              // Node type lives in low bits of next.
+ 
+typedef union _slot {
+    char inl[PRMP_INLINE_SIZE];           // Short string, NUL terminated.
+    struct {
+        uint32_t off;                     // Arena offset of string or anchor.
+        uint8_t  spare[3];
+        uint8_t  tag;                     // PRMP_SLOT_xxx bits.
+    } ool;
+} PRMP_SLOT;
+ 
+ 
+typedef struct _node {
+    uint32_t  next;                       // Next node at this level | type.
+    PRMP_SLOT key;
+    PRMP_SLOT value;                      // String or anchor of next level.
+} PRMP_NODE;
+ 
+ 
+typedef struct _anchor {
+    uint32_t up;
+    uint32_t first;
+    uint32_t last;
+    uint32_t index;                       // 1 + handle index slot, or the
+                                          // index's offset when shared.
+} PRMP_ANCHOR;
+ 
+ 
+#define PRMP_NODE_TYPE(node)  ((int) ((node)->next & PRMP_TYPE_MASK))
+#define PRMP_NODE_NEXT(node)  ((node)->next & ~PRMP_TYPE_MASK)
+ 
+ 
+int parmRoot(      void* handle, char** base, PRMP_ANCHOR** anchor);
+int parmNodeValue( void* handle, PRMP_NODE* node, char** value);
+ 
+#ifdef __cplusplus
+}
+#endif
+ 
+#endif // PARMNODE_H_
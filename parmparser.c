@@ -33,9 +33,17 @@
 //
 //----------------------------------------------------------------------
 #include <string.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
  
 typedef int BOOL; 
 #define TRUE (!(0))
@@ -43,62 +51,115 @@ typedef int BOOL;
 
  
 #include "parmparser.h"
+#include "parmnode.h"
  
  
 #define PRMP_MAX_LEVELS  5               // Maximum allowable parameter levels.
  
 typedef struct _prmp_handle {
+    char*           base;        // Arena holding all parsed nodes and strings.
+    uint32_t        used;        // How much of the arena is in use.
     struct _anchor* anchor;
-    void*           gtms;
     struct _anchor* cur_anchor;
     struct _node*   cur_node;
     struct _node*   node_stack[PRMP_MAX_LEVELS];
     int             node_stack_index;
+    BOOL            in_context;  // Arena belongs to a parse context.
+    char**          memo;        // Values decoded so far (see resolveValue).
+    uint32_t        memo_count;
+    uint32_t        memo_size;
+    uint32_t**      indexes;     // Sorted key indexes built so far (see levelIndex).
+    uint32_t        index_count;
+    uint32_t        index_size;
+    uint32_t        index_alloc; // Index buffers allocated, kept between parses.
+    uint32_t*       index_work;  // Work area for sorting an index.
+    uint32_t        index_work_size;
+    char*           shm_base;    // Shared memory segment we are attached to.
+    size_t          shm_size;
 } PRMP_HANDLE;
  
 
-typedef struct _node {
-    struct _node* next;
-    char* key;
-    char  type;
-    union {
-        char* value;
-        struct _anchor* nextlevel;
-    };
-} PRMP_NODE;
+typedef struct _arena {
+    char*    base;
+    uint32_t used;
+    uint32_t size;
+} PRMP_ARENA;
  
-
-typedef struct _anchor {
-    struct _anchor* up;
-    struct _node* first;
-    struct _node* last;
-} PRMP_ANCHOR;
+#define PRMP_ARENA_INIT_SIZE  65536
+ 
+#define ARENA_PTR(base, off)  ((void*) ((base) + (off)))
  
 
 #define PRMP_STRING_WORK_SIZE  512
+#define PRMP_READ_BLOCK_SIZE   65536     // Size of blocks pulled from a reader.
+ 
+
+//----------------------------------------------------------------------
+// The parser is a state machine fed a block of characters at a time, so
+// it can stop at the end of any block (even in the middle of a string)
+// and pick up again with the next one. Where it is within a string...
+//----------------------------------------------------------------------
+#define PS_BLANK    0                    // Between strings.
+#define PS_STRING   1                    // In an unquoted string.
+#define PS_QUOTED   2                    // In a quoted string.
+#define PS_ESCAPE   3                    // Right after \ in a double quoted string.
+#define PS_COMMENT  4                    // In a comment, until end of line.
+#define PS_RESYNC   5                    // Skipping to end of line or } after an error.
+ 
+// ...and what it wants next within a level...
+#define PX_KEY      0                    // A key (or } to end the level).
+#define PX_COLON    1                    // The : after a key.
+#define PX_VALUE    2                    // A value (or { to start a level).
+ 
+// Room for the errors of one parse. Without recovery, there is just one...
+#define ERROR_SLOTS(parms)  ((parms)->error_max > 0 ? (parms)->error_max : 1)
  
 
 typedef struct _parse_block {
-    FILE*  fs;                    // File "thread" handle.
-    char*  next_buf;              // Current buffer that we just read.
-    char*  buf;                   // Ptr within next_buf, yet to be parsed.
-    int    len;                   // Remaining len to parse in buf;
-    BOOL   is_eof;                // We've hit end-of-file.
-    BOOL   have_line;             // If false, then we need to get first/next line.
+    PRMP_READER* reader;          // Where the input comes from (NULL if fed).
+    char*  in_buf;                // Block most recently pulled from reader.
+    int    state;                 // PS_xxx.
+    int    expect;                // PX_xxx.
+    char   quote_char;            // Quote that ends the current quoted string.
+    BOOL   in_ref;                // Inside the {} of a ${} reference.
+    BOOL   have_cr;               // Held back a CR, to see if LF follows.
+    int    rc;                    // First error. Once set, we stop parsing.
+    int    depth;                 // Number of levels opened but not closed.
+    uint32_t node;                // Node we have the key for.
     int    linenbr;               // Current line number (helpful for error msgs).
     int    offset;                // Offset into current line (helpful for error msgs).
+    long   bytes;                 // Bytes parsed so far.
+    int    tok_line;              // Where the current string started...
+    int    tok_column;
+    long   tok_offset;
+    BOOL   tok_error;             // Error is about that string, not the char we're on.
+    PRMP_ERROR* errors;           // Errors found by the last parse.
+    int    error_count;           // Number of errors in errors.
+    int    error_max;             // Errors to collect before giving up (recovery mode).
+    BOOL   restart;               // Start over before taking more input.
     char*  str_wrk;               // A work area for parsed out string.
     int    str_wrk_len;           // Total size of work string.
     int    str_len;               // Size of string in work string.
-    void*  gtms;                  // Handle for GTMS temp storage allocation.
-    PRMP_ANCHOR* top_anchor;      // Anchor to all parsed nodes.
-    PRMP_ANCHOR* current_anchor;  // Anchor parsed nodes at current level.
+    int    str_flags;             // PRMP_SLOT_ESC/INTERP seen in work string.
+    PRMP_ARENA arena;             // Where parsed nodes and strings go.
+    uint32_t top_anchor;          // Anchor to all parsed nodes.
+    uint32_t current_anchor;      // Anchor parsed nodes at current level.
 } PARSE_BLOCK;
  
  
+//----------------------------------------------------------------------
+// A parse context keeps the parse block, its buffers and its arena warm
+// between parses. The handle of the last parse lives in the context and
+// is good until the next parse with it...
+//----------------------------------------------------------------------
+typedef struct _prmp_context {
+    PARSE_BLOCK  parms;
+    PRMP_HANDLE  handle;
+} PRMP_CONTEXT;
+ 
+ 
 
-static int parmParse(void** handle, PARSE_BLOCK* cbParms);
-static int parmParseNode( PARSE_BLOCK* parms, PRMP_ANCHOR* anchor);
+static int parmParse(PARSE_BLOCK* parms);
  
  
 
@@ -112,606 +173,2434 @@ void* parmGmem( int size, char* id)    // Allocate a parse blok.
     return calloc(1, size);
 }
 
-void* parmGtms( void**gtms, int size, char* id) {
-    // For now, do not include block id...
-    return calloc(1, size);
-}
-
 void parmFmem( void* p) {
     free(p);
 }
 
 
-
 //----------------------------------------------------------------------
-// Routine to read another line from file...
+// Carve size bytes out of the arena and return their offset, or 0 if
+// we are out of memory. The arena may move, so callers must re-derive
+// any pointers into it afterwards...
 //----------------------------------------------------------------------
-static int callbackIo(PARSE_BLOCK* parms)
+static uint32_t arenaAlloc( PRMP_ARENA* arena, uint32_t size, uint32_t align)
 {
-    char *s;
-    int   len;
- 
-    if( parms->next_buf == NULL ) {
-        parms->next_buf = parmGmem(PRMP_STRING_WORK_SIZE, "WBUF");
+    uint32_t off = (arena->used + align - 1) & ~(align - 1);
+    uint64_t need = (uint64_t) off + size;
+    char*    base;
+
+    if( need > arena->size ) {
+        uint64_t new_size = arena->size ? arena->size : PRMP_ARENA_INIT_SIZE;
+
+        while( new_size < need )
+            new_size *= 2;
+        if( new_size > UINT32_MAX )
+            new_size = UINT32_MAX;
+        if( need > new_size )
+            return 0;                   // Offsets no longer fit in 32 bits.
+
+        if( (base = realloc( arena->base, (size_t) new_size)) == NULL )
+            return 0;
+
+        arena->base = base;
+        arena->size = (uint32_t) new_size;
     }
 
-    do {            // Make sure we get a line (no blank lines after removing cr/lf)...
+    memset( arena->base + off, 0, size);
+    arena->used = (uint32_t) need;
 
-        if( (s = fgets( parms->next_buf, PRMP_STRING_WORK_SIZE, parms->fs )) == NULL ) {
-            return -4;
-        }
+    return off;
+}
 
-        if ( feof(parms->fs) ) {
-            return -4;
-        }
 
-        len = strlen(parms->next_buf);
+// Return a key or value string kept in a node slot...
+static char* slotString( char* base, PRMP_SLOT* slot)
+{
+    if( slot->ool.tag & PRMP_SLOT_OOL )
+        return base + slot->ool.off;
 
-        // Actually, we do support larger lines since fgets() will divide lines.  We can
-        // work with that.  For now, leaving this test in place...
-        if( len >=  PRMP_STRING_WORK_SIZE) { 
-            return -2;                   // Line too long error.
-        }
+    return slot->inl;
+}
 
-        // Check for either windows or linux line terminators and remove...
-        // Windows will have a line ending in 0x0d0a, linux lines end with just 0x0a.
-        // There might be a chance that this line is larger than can fit in the buffer
-        // which means there may not be any line terminators at the end, since the
-        // line will continue with the next fgets() read.  There might be a case where
-        // The line is just long enough that fgets() returns the CR but not the LF...
 
-        if ( len > 0 && parms->next_buf[len - 1] == 0x0a ) {
-            parms->next_buf[--len] = 0;
-        }
-        if ( len > 0 && parms->next_buf[len - 1] == 0x0d ) {
-            parms->next_buf[--len] = 0;
+
+//----------------------------------------------------------------------
+// Input sources. A file descriptor reader keeps the fd in ctx itself, so
+// it needs no storage and leaves closing the fd to the caller...
+//----------------------------------------------------------------------
+static int readFd( void* ctx, char* buf, int len)
+{
+    int n;
+
+    do {
+        n = read( (int) (long) ctx, buf, len);
+    } while( n < 0 && errno == EINTR );
+
+    return n;
+}
+
+int parmReaderFd( PRMP_READER* reader, int fd)
+{
+    reader->ctx   = (void*) (long) fd;
+    reader->read  = readFd;
+    reader->close = NULL;
+    return 0;
+}
+
+
+// A stdio stream reader (stdin, popen() pipes, fopen() files)...
+static int readStream( void* ctx, char* buf, int len)
+{
+    FILE* fs = (FILE*) ctx;
+    int   n;
+
+    n = (int) fread( buf, 1, len, fs);
+    if( n == 0 && ferror(fs) )
+        return -4;
+
+    return n;
+}
+
+int parmReaderStream( PRMP_READER* reader, FILE* fs)
+{
+    reader->ctx   = (void*) fs;
+    reader->read  = readStream;
+    reader->close = NULL;
+    return 0;
+}
+
+
+// A memory reader hands out a caller owned buffer...
+typedef struct _mem_source {
+    const char* buf;
+    int         len;
+    int         pos;
+} MEM_SOURCE;
+
+static int readMemory( void* ctx, char* buf, int len)
+{
+    MEM_SOURCE* mem = (MEM_SOURCE*) ctx;
+
+    if( len > mem->len - mem->pos )
+        len = mem->len - mem->pos;
+
+    memcpy( buf, mem->buf + mem->pos, len);
+    mem->pos += len;
+
+    return len;
+}
+
+int parmReaderMemory( PRMP_READER* reader, const char* buf, int len)
+{
+    MEM_SOURCE* mem;
+
+    if( (mem = parmGmem( sizeof(MEM_SOURCE), "PMEM")) == NULL )
+        return -3;
+
+    mem->buf      = buf;
+    mem->len      = len;
+    reader->ctx   = mem;
+    reader->read  = readMemory;
+    reader->close = parmFmem;
+    return 0;
+}
+
+
+//----------------------------------------------------------------------
+// Read-ahead reader. A helper thread keeps pulling blocks from the
+// source into one of two buffers while the parser drains the other, so
+// a slow pipe or network file system is read while we tokenize...
+//----------------------------------------------------------------------
+typedef struct _read_ahead {
+    PRMP_READER     source;
+    pthread_t       thread;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    char*           block[2];
+    int             block_len[2];  // Bytes in block. 0 is EOF, < 0 error.
+    BOOL            full[2];       // Block is waiting to be drained.
+    int             fill;          // Block the helper thread fills next.
+    int             drain;         // Block the parser drains next.
+    int             drain_pos;     // How far the parser got in that block.
+    BOOL            stop;          // Reader is being closed.
+} READ_AHEAD;
+
+static void* readAheadThread( void* arg)
+{
+    READ_AHEAD* ra = (READ_AHEAD*) arg;
+    int         n;
+
+    do {
+        pthread_mutex_lock( &ra->lock );
+        while( ra->full[ra->fill] && !ra->stop )
+            pthread_cond_wait( &ra->cond, &ra->lock );
+        if( ra->stop ) {
+            pthread_mutex_unlock( &ra->lock );
+            break;
         }
+        pthread_mutex_unlock( &ra->lock );
+
+        // The block we fill is never the one being drained, so no lock here...
+        n = ra->source.read( ra->source.ctx, ra->block[ra->fill], PRMP_READ_BLOCK_SIZE);
+
+        pthread_mutex_lock( &ra->lock );
+        ra->block_len[ra->fill] = n;
+        ra->full[ra->fill]      = TRUE;
+        ra->fill ^= 1;
+        pthread_cond_broadcast( &ra->cond );
+        pthread_mutex_unlock( &ra->lock );
+
+    } while( n > 0 );               // Stop after handing over EOF or an error.
+
+    return NULL;
+}
+
+static int readAhead( void* ctx, char* buf, int len)
+{
+    READ_AHEAD* ra = (READ_AHEAD*) ctx;
+    int         n;
+
+    pthread_mutex_lock( &ra->lock );
+    while( !ra->full[ra->drain] )
+        pthread_cond_wait( &ra->cond, &ra->lock );
+    n = ra->block_len[ra->drain];
+    pthread_mutex_unlock( &ra->lock );
 
-    } while ( len == 0 );               // No empty lines (after pealing off cr/lf).
+    if( n <= 0 )                    // EOF or error stays put for later calls.
+        return n;
 
-    parms->linenbr++;
-    parms->offset = 0;
+    if( len > n - ra->drain_pos )
+        len = n - ra->drain_pos;
+    memcpy( buf, ra->block[ra->drain] + ra->drain_pos, len);
+    ra->drain_pos += len;
+
+    // Drained the whole block? Then hand it back to the helper thread...
+    if( ra->drain_pos == n ) {
+        pthread_mutex_lock( &ra->lock );
+        ra->full[ra->drain] = FALSE;
+        ra->drain ^= 1;
+        ra->drain_pos = 0;
+        pthread_cond_broadcast( &ra->cond );
+        pthread_mutex_unlock( &ra->lock );
+    }
 
     return len;
 }
+
+// Closing waits for a read the helper thread may still have in flight...
+static void closeReadAhead( void* ctx)
+{
+    READ_AHEAD* ra = (READ_AHEAD*) ctx;
+
+    pthread_mutex_lock( &ra->lock );
+    ra->stop = TRUE;
+    pthread_cond_broadcast( &ra->cond );
+    pthread_mutex_unlock( &ra->lock );
+
+    pthread_join( ra->thread, NULL );
+    pthread_cond_destroy( &ra->cond );
+    pthread_mutex_destroy( &ra->lock );
+
+    parmReaderClose( &ra->source );
+    parmFmem( ra->block[0] );
+    parmFmem( ra->block[1] );
+    parmFmem( ra );
+}
+
+int parmReaderReadAhead( PRMP_READER* reader, PRMP_READER* source)
+{
+    READ_AHEAD* ra;
+
+    if( (ra = parmGmem( sizeof(READ_AHEAD), "PRDA")) == NULL )
+        return -3;
+
+    ra->source   = *source;
+    ra->block[0] = parmGmem( PRMP_READ_BLOCK_SIZE, "PRDB");
+    ra->block[1] = parmGmem( PRMP_READ_BLOCK_SIZE, "PRDB");
+    if( ra->block[0] == NULL || ra->block[1] == NULL ) {
+        parmFmem( ra->block[0] );
+        parmFmem( ra->block[1] );
+        parmFmem( ra );
+        return -3;
+    }
+
+    pthread_mutex_init( &ra->lock, NULL );
+    pthread_cond_init( &ra->cond, NULL );
+
+    if( pthread_create( &ra->thread, NULL, readAheadThread, ra) != 0 ) {
+        pthread_cond_destroy( &ra->cond );
+        pthread_mutex_destroy( &ra->lock );
+        parmFmem( ra->block[0] );
+        parmFmem( ra->block[1] );
+        parmFmem( ra );
+        return -3;
+    }
+
+    reader->ctx   = ra;             // Reader now owns the source.
+    reader->read  = readAhead;
+    reader->close = closeReadAhead;
+    return 0;
+}
+
+
+void parmReaderClose( PRMP_READER* reader)
+{
+    if( reader->close != NULL )
+        reader->close( reader->ctx );
+
+    reader->ctx   = NULL;
+    reader->close = NULL;
+}
+
+
+
+//----------------------------------------------------------------------
+// Routine to allocate and initialize PARSE_BLOCK...
+//----------------------------------------------------------------------
+static PARSE_BLOCK* initParseBlock()
+{
+    return parmGmem( sizeof(PARSE_BLOCK), "PRMP");  // Allocate a parse blok.
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Routine to get a PARSE_BLOCK ready for parsing from reader (or from
+// whatever gets fed to it). Buffers left over from an earlier parse are
+// reused...
+//----------------------------------------------------------------------
+static int startParseBlock(PARSE_BLOCK* parms, PRMP_READER* reader)
+{
+    // Allocate memory for a workarea to be used for parsing strings...
+    if( parms->str_wrk == NULL ) {
+        if(( parms->str_wrk = parmGmem(PRMP_STRING_WORK_SIZE, "PSTR")) == NULL) {
+            return -3;
+        }
+        parms->str_wrk_len = PRMP_STRING_WORK_SIZE;
+    }
+ 
+    if( parms->errors == NULL &&
+        (parms->errors = parmGmem( ERROR_SLOTS(parms) * sizeof(PRMP_ERROR), "PERR")) == NULL ) {
+        return -3;
+    }
+ 
+    parms->reader    = reader;
+    parms->state     = PS_BLANK;
+    parms->expect    = PX_KEY;
+    parms->in_ref    = FALSE;
+    parms->have_cr   = FALSE;
+    parms->rc        = 0;
+    parms->depth     = 0;
+    parms->node      = 0;
+    parms->linenbr   = 1;
+    parms->offset    = 0;
+    parms->bytes     = 0;
+    parms->tok_error = FALSE;
+    parms->error_count = 0;
+    parms->restart   = FALSE;
+    parms->str_len   = 0;
+    parms->str_flags = 0;
+ 
+    // Offset 0 means "none", so start the arena past it. Then allocate the
+    // top-level anchor block for our parsed nodes...
+    parms->arena.used = sizeof(uint32_t);
+    if( (parms->top_anchor = arenaAlloc( &parms->arena, sizeof(PRMP_ANCHOR), 4)) == 0 ) {
+        return -3;
+    }
+    parms->current_anchor = parms->top_anchor;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Routine to free whatever a PARSE_BLOCK has allocated...
+//----------------------------------------------------------------------
+static void releaseParseBlock(PARSE_BLOCK* parms)
+{
+    if( parms->str_wrk )
+        parmFmem(parms->str_wrk);
+    if( parms->in_buf )
+        parmFmem(parms->in_buf);
+    if( parms->errors )
+        parmFmem(parms->errors);
+    if( parms->arena.base )             // Not handed off to a handle?
+        parmFmem(parms->arena.base);
+ 
+    memset( parms, 0, sizeof(PARSE_BLOCK));
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Routine to clean up and free PARSE_BLOCK...
+//----------------------------------------------------------------------
+static int freeParseBlock(PARSE_BLOCK* parms)
+{
+    releaseParseBlock( parms );
+ 
+    parmFmem( (void*) parms);
+ 
+    return 0;
+}
+ 
+ 
+ 
+//-----------------------------------------------------------------------
+// Add characters to the string in our str_wrk area, growing it as need
+// be. Note a ${ (outside single quotes) so the value gets expanded...
+//-----------------------------------------------------------------------
+static int add_chars( PARSE_BLOCK* parms, const char* s, int len)
+{
+    char* str_wrk;
+    int   size;
+ 
+    if( parms->str_len + len >= parms->str_wrk_len ) {
+        for( size = parms->str_wrk_len * 2; parms->str_len + len >= size; size *= 2 );
+        if( (str_wrk = realloc( parms->str_wrk, size)) == NULL )
+            return -3;               // Out of memory!
+        parms->str_wrk     = str_wrk;
+        parms->str_wrk_len = size;
+    }
+ 
+    if( len > 0 && s[0] == '{' && parms->str_len > 0 && parms->str_wrk[parms->str_len - 1] == '$' &&
+        !(parms->state == PS_QUOTED && parms->quote_char == '\'') )
+        parms->str_flags |= PRMP_SLOT_INTERP;
+ 
+    memcpy( parms->str_wrk + parms->str_len, s, len);
+    parms->str_len += len;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Put the string in our work area into a node slot...
+//----------------------------------------------------------------------
+static int make_slot( PARSE_BLOCK* parms, PRMP_SLOT* slot, int flags)
+{
+    uint32_t off;
+ 
+    memset( slot, 0, sizeof(PRMP_SLOT));
+ 
+    // Short enough (and no decoding) to keep inline?
+    if( parms->str_len < PRMP_INLINE_SIZE && flags == 0 ) {
+        memcpy( slot->inl, parms->str_wrk, parms->str_len);
+        return 0;
+    }
+ 
+    if( (off = arenaAlloc( &parms->arena, parms->str_len + 1, 1)) == 0 ) {
+        return -3;           // Out of memory!
+    }
+ 
+    memcpy( ARENA_PTR(parms->arena.base, off), parms->str_wrk, parms->str_len);
+    slot->ool.off = off;
+    slot->ool.tag = PRMP_SLOT_OOL | flags;
+ 
+    return 0;
+}
+ 
+ 
+#define NODE_AT(parms, off)    ((PRMP_NODE*)   ARENA_PTR((parms)->arena.base, off))
+#define ANCHOR_AT(parms, off)  ((PRMP_ANCHOR*) ARENA_PTR((parms)->arena.base, off))
+ 
+ 
+//----------------------------------------------------------------------
+// Add the node we have the key for to the chain off the current anchor...
+//----------------------------------------------------------------------
+static void link_node( PARSE_BLOCK* parms)
+{
+    PRMP_ANCHOR* anc = ANCHOR_AT(parms, parms->current_anchor);
+ 
+    if( anc->first == 0 ) {
+        anc->first = parms->node;
+        anc->last  = parms->node;
+    } else {
+        NODE_AT(parms, anc->last)->next |= parms->node;
+        anc->last = parms->node;
+    }
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Work out the escape at p (a \ and what follows it). Puts the character
+// it stands for in c and returns how many characters the escape takes
+// up, or returns 0 if it isn't one we know (those are kept as is)...
+//----------------------------------------------------------------------
+static int decodeEscape( const char* p, char* c)
+{
+    char hex[3];
+ 
+    switch( p[1] ) {
+    case 'n':  *c = '\n'; return 2;
+    case 'r':  *c = '\r'; return 2;
+    case 't':  *c = '\t'; return 2;
+    case '"':
+    case '\'':
+    case '\\':
+    case '$':  *c = p[1]; return 2;
+    case 'x':
+        if( isxdigit( (unsigned char) p[2]) && isxdigit( (unsigned char) p[3]) ) {
+            hex[0] = p[2];
+            hex[1] = p[3];
+            hex[2] = 0;
+            *c = (char) strtol( hex, NULL, 16);
+            return 4;
+        }
+    }
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// We have a key. Start a node for it. Keys are always looked at, so
+// unlike values, their escapes are decoded right away (in place, since
+// that only makes the string shorter). A \x00 is dropped...
+//----------------------------------------------------------------------
+static int parse_key( PARSE_BLOCK* parms)
+{
+    PRMP_SLOT key;
+    char* s = parms->str_wrk;
+    char  c;
+    int   i;
+    int   j;
+    int   n;
+ 
+    if( parms->str_flags & PRMP_SLOT_ESC ) {
+        s[parms->str_len] = 0;      // There is always room for this.
+        for( i = j = 0; i < parms->str_len; ) {
+            if( s[i] == '\\' && s[i + 1] != 0 && (n = decodeEscape( s + i, &c)) > 0 ) {
+                if( c != 0 )
+                    s[j++] = c;
+                i += n;
+            } else if( s[i] == '\\' && s[i + 1] != 0 ) {
+                s[j++] = s[i++];
+                s[j++] = s[i++];
+            } else {
+                s[j++] = s[i++];
+            }
+        }
+        parms->str_len = j;
+    }
+ 
+    if( parms->str_len == 0 )
+        return -2;                  // Empty key. Syntax error!
+ 
+    if( (parms->node = arenaAlloc( &parms->arena, sizeof(PRMP_NODE), 4)) == 0 ||
+        make_slot( parms, &key, 0 ) < 0 ) {
+        return -3;           // Out of memory!
+    }
+ 
+    NODE_AT(parms, parms->node)->key = key;
+    parms->expect = PX_COLON;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// We have a string value. That completes the node...
+//----------------------------------------------------------------------
+static int parse_value( PARSE_BLOCK* parms)
+{
+    PRMP_SLOT value;
+ 
+    if( make_slot( parms, &value, parms->str_flags ) < 0 ) {
+        return -3;           // Out of memory!
+    }
+ 
+    NODE_AT(parms, parms->node)->value = value;
+    NODE_AT(parms, parms->node)->next |= PRMP_STRING;
+    link_node( parms );
+    parms->expect = PX_KEY;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// A string just ended. Whether it is a key or a value depends on what
+// we expect...
+//----------------------------------------------------------------------
+static int end_string( PARSE_BLOCK* parms)
+{
+    int rc;
+ 
+    parms->state = PS_BLANK;
+ 
+    switch( parms->expect ) {
+    case PX_KEY:    rc = parse_key( parms );   break;
+    case PX_VALUE:  rc = parse_value( parms ); break;
+    default:        rc = -2;                   break;   // Two strings in a row!
+    }
+ 
+    if( rc == -2 )
+        parms->tok_error = TRUE;          // Report it where the string started.
+ 
+    parms->str_len   = 0;
+    parms->str_flags = 0;
+ 
+    return rc;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Handle a :, { or } between strings. A { starts the next level down
+// as the value of the node we have the key for, a } ends the level...
+//----------------------------------------------------------------------
+static int parse_punct( PARSE_BLOCK* parms, unsigned char c)
+{
+    uint32_t nextlevel;
+ 
+    if( c == ':' && parms->expect == PX_COLON ) {
+        parms->expect = PX_VALUE;
+ 
+    } else if( c == '{' && parms->expect == PX_VALUE ) {
+        if( (nextlevel = arenaAlloc( &parms->arena, sizeof(PRMP_ANCHOR), 4)) == 0 ) {
+            return -3;           // Out of memory!
+        }
+        ANCHOR_AT(parms, nextlevel)->up = parms->current_anchor;
+        NODE_AT(parms, parms->node)->value.ool.off = nextlevel;
+        NODE_AT(parms, parms->node)->value.ool.tag = PRMP_SLOT_OOL;
+        NODE_AT(parms, parms->node)->next         |= PRMP_NEXTLEVEL;
+        link_node( parms );
+ 
+        parms->current_anchor = nextlevel;
+        parms->depth++;
+        parms->expect = PX_KEY;
+ 
+    } else if( c == '}' && parms->expect == PX_KEY && parms->depth > 0 ) {
+        parms->current_anchor = ANCHOR_AT(parms, parms->current_anchor)->up;
+        parms->depth--;
+ 
+    } else {
+        return -2;                  // Syntax error!
+    }
+ 
+    return 0;
+}
+ 
+ 
+//-----------------------------------------------------------------------
+// What the parser was looking for when it hit an error...
+//-----------------------------------------------------------------------
+static const char* expecting( PARSE_BLOCK* parms, int rc)
+{
+    if( rc != -2 )
+        return NULL;
+ 
+    switch( parms->state ) {
+    case PS_QUOTED:
+    case PS_ESCAPE:  return "closing quote";
+    case PS_STRING:  return "end of string";
+    }
+ 
+    switch( parms->expect ) {
+    case PX_COLON:   return "':'";
+    case PX_VALUE:   return "value or '{'";
+    default:         return parms->depth > 0 ? "key or '}'" : "key";
+    }
+}
+ 
+ 
+//-----------------------------------------------------------------------
+// Note an error where we are in the input, or for an error about a
+// string (such as a key with no : after it), where the string started...
+//-----------------------------------------------------------------------
+static void add_error( PARSE_BLOCK* parms, int rc)
+{
+    PRMP_ERROR* error;
+    BOOL  at_token = parms->tok_error;
+ 
+    parms->tok_error = FALSE;
+    if( parms->errors == NULL || parms->error_count >= ERROR_SLOTS(parms) )
+        return;
+ 
+    error = &parms->errors[parms->error_count++];
+    error->code     = rc;
+    error->line     = at_token ? parms->tok_line   : parms->linenbr;
+    error->column   = at_token ? parms->tok_column : parms->offset + 1;
+    error->offset   = at_token ? parms->tok_offset : parms->bytes;
+    error->expected = expecting( parms, rc );
+}
+ 
+ 
+//-----------------------------------------------------------------------
+// An error at character c. In recovery mode, a syntax error drops what
+// we have of the current key/value pair and we pick up again at the
+// next line (or the } that ends the level), until we have collected
+// error_max errors...
+//-----------------------------------------------------------------------
+static int parse_error( PARSE_BLOCK* parms, int rc, int c)
+{
+    add_error( parms, rc );
+ 
+    if( rc != -2 || parms->error_count >= parms->error_max )
+        return rc;                        // Give up.
+ 
+    parms->str_len   = 0;
+    parms->str_flags = 0;
+    parms->in_ref    = FALSE;
+    parms->expect    = PX_KEY;
+    parms->state     = PS_RESYNC;
+ 
+    if( c == '\n' ) {
+        parms->state = PS_BLANK;
+    } else if( c == '}' && parms->depth > 0 ) {
+        parms->state = PS_BLANK;
+        return parse_punct( parms, c);
+    }
+ 
+    return 0;
+}
+ 
+ 
+//-----------------------------------------------------------------------
+// Parse one character. Comments (# outside quotes) run to the end of
+// the line, and an end of line in quotes counts as a space...
+//-----------------------------------------------------------------------
+static int scan_char( PARSE_BLOCK* parms, unsigned char c)
+{
+    int rc;
+ 
+    switch( parms->state ) {
+ 
+    case PS_COMMENT:
+        if( c == '\n' )
+            parms->state = PS_BLANK;
+        return 0;
+ 
+    case PS_RESYNC:
+        if( c == '\n' ) {
+            parms->state = PS_BLANK;
+        } else if( c == '}' ) {
+            parms->state = PS_BLANK;
+            if( parms->depth > 0 )
+                return parse_punct( parms, c);
+        }
+        return 0;
+ 
+    case PS_ESCAPE:                       // Keep escapes raw, decoded on use.
+        parms->state = PS_QUOTED;
+        if( c == '\n' )
+            c = ' ';
+        return add_chars( parms, (char*) &c, 1);
+ 
+    case PS_QUOTED:
+        if( c == (unsigned char) parms->quote_char )
+            return end_string( parms );
+        if( c == '\\' && parms->quote_char == '"' ) {
+            parms->state      = PS_ESCAPE;
+            parms->str_flags |= PRMP_SLOT_ESC;
+            return add_chars( parms, "\\", 1);
+        }
+        if( c == '\n' )
+            c = ' ';
+        return add_chars( parms, (char*) &c, 1);
+ 
+    case PS_STRING:
+        // A ${} reference's braces are part of the string...
+        if( c == '{' && parms->str_wrk[parms->str_len - 1] == '$' ) {
+            parms->in_ref = TRUE;
+            return add_chars( parms, (char*) &c, 1);
+        }
+        if( c == '}' && parms->in_ref ) {
+            parms->in_ref = FALSE;
+            return add_chars( parms, (char*) &c, 1);
+        }
+        if( c == '"' || c == '\'' )
+            return -2;                    // Quote in the middle of a string!
+        if( c != ' ' && c != '\t' && c != '\n' && c != '\r' &&
+            c != ':' && c != '{' && c != '}' && c != '#' )
+            return add_chars( parms, (char*) &c, 1);
+ 
+        // End of the string. The character that ended it is handled
+        // just like one between strings...
+        if( (rc = end_string( parms )) < 0 )
+            return rc;
+        // Fall through...
+ 
+    case PS_BLANK:
+    default:
+        if( c == ' ' || c == '\t' || c == '\n' || c == '\r' )
+            return 0;
+        if( c == '#' ) {
+            parms->state = PS_COMMENT;
+            return 0;
+        }
+        if( c == ':' || c == '{' || c == '}' )
+            return parse_punct( parms, c);
+ 
+        parms->in_ref     = FALSE;
+        parms->tok_line   = parms->linenbr;
+        parms->tok_column = parms->offset + 1;
+        parms->tok_offset = parms->bytes;
+        if( c == '"' || c == '\'' ) {
+            parms->quote_char = c;
+            parms->state      = PS_QUOTED;
+            return 0;
+        }
+        parms->state = PS_STRING;
+        return add_chars( parms, (char*) &c, 1);
+    }
+}
+ 
+ 
+//-----------------------------------------------------------------------
+// Parse one character, keeping track of where we are for errors...
+//-----------------------------------------------------------------------
+static int parse_char( PARSE_BLOCK* parms, unsigned char c)
+{
+    int rc;
+ 
+    if( (rc = scan_char( parms, c )) < 0 )
+        rc = parse_error( parms, rc, c );
+ 
+    if( c == '\n' ) {
+        parms->linenbr++;
+        parms->offset = 0;
+    } else {
+        parms->offset++;
+    }
+    parms->bytes++;
+ 
+    return rc;
+}
+ 
+ 
+//-----------------------------------------------------------------------
+// Parse a block of characters. Runs of plain characters within strings
+// and comments are taken in one go. A CR is held back until we see if
+// it is the first half of a CR/LF...
+//-----------------------------------------------------------------------
+static int parse_chars( PARSE_BLOCK* parms, const char* buf, int len)
+{
+    const char* p   = buf;
+    const char* end = buf + len;
+    const char* run;
+    unsigned char c;
+    int   rc = 0;
+ 
+    if( parms->rc < 0 )                   // Already failed? Ignore the rest.
+        return parms->rc;
+ 
+    while( p < end && rc == 0 ) {
+ 
+        if( parms->have_cr ) {
+            parms->have_cr = FALSE;
+            if( *p == '\n' )
+                parms->bytes++;           // Drop the CR of a CR/LF.
+            else if( (rc = parse_char( parms, '\r' )) < 0 )
+                break;
+        }
+ 
+        run = p;
+        switch( parms->state ) {
+        case PS_STRING:
+            while( p < end && (c = *p) != ' ' && c != '\t' && c != '\n' && c != '\r' &&
+                   c != ':' && c != '{' && c != '}' && c != '#' && c != '"' && c != '\'' )
+                p++;
+            break;
+        case PS_QUOTED:
+            while( p < end && (c = *p) != (unsigned char) parms->quote_char &&
+                   c != '\\' && c != '\n' && c != '\r' && c != '{' )
+                p++;
+            break;
+        case PS_COMMENT:
+            if( (p = memchr( run, '\n', end - run)) == NULL )
+                p = end;
+            break;
+        case PS_RESYNC:
+            while( p < end && *p != '\n' && *p != '}' )
+                p++;
+            break;
+        }
+ 
+        if( p > run ) {
+            if( parms->state != PS_COMMENT && parms->state != PS_RESYNC &&
+                (rc = add_chars( parms, run, (int) (p - run))) < 0 )
+                rc = parse_error( parms, rc, 0 );
+            parms->offset += (int) (p - run);
+            parms->bytes  += (long) (p - run);
+            continue;
+        }
+ 
+        if( *p == '\r' ) {
+            parms->have_cr = TRUE;
+            p++;
+            continue;
+        }
+ 
+        rc = parse_char( parms, (unsigned char) *p++ );
+    }
+ 
+    if( rc < 0 )
+        parms->rc = rc;
+ 
+    return rc;
+}
+ 
+ 
+//-----------------------------------------------------------------------
+// End of input. Whatever string we were in ends here, and every level
+// must have been closed. If errors were collected on the way, the parse
+// fails with the first one...
+//-----------------------------------------------------------------------
+static int finish_chars( PARSE_BLOCK* parms)
+{
+    int rc = 0;
+ 
+    if( parms->rc < 0 )
+        return parms->rc;
+ 
+    if( parms->have_cr ) {                // A CR at the very end is dropped.
+        parms->have_cr = FALSE;
+        parms->bytes++;
+    }
+ 
+    if( parms->state == PS_STRING )
+        rc = end_string( parms );
+    else if( parms->state == PS_QUOTED || parms->state == PS_ESCAPE )
+        rc = -2;                          // End of input in quotes!
+ 
+    if( rc == 0 && (parms->expect != PX_KEY || parms->depth > 0) )
+        rc = -2;                          // Missing value or missing }!
+ 
+    if( rc < 0 )
+        add_error( parms, rc );
+    if( parms->error_count > 0 )
+        rc = parms->errors[0].code;
+ 
+    if( rc < 0 )
+        parms->rc = rc;
+ 
+    return rc;
+}
+ 
+ 
+ 
+//----------------------------------------------------------------------
+// Free the values a handle has decoded and forget the indexes it has
+// built. The index buffers are kept for the next parse (with a parse
+// context) unless tables is TRUE, in which case they go too, along with
+// the tables that keep track of everything...
+//----------------------------------------------------------------------
+static void freeLazy(PRMP_HANDLE* prmp, BOOL tables)
+{
+    uint32_t i;
+ 
+    for( i = 0; i < prmp->memo_count; i++ )
+        parmFmem( prmp->memo[i] );
+ 
+    prmp->memo_count  = 0;
+    prmp->index_count = 0;
+ 
+    if( tables ) {
+        for( i = 0; i < prmp->index_alloc; i++ )
+            parmFmem( prmp->indexes[i] );
+        parmFmem( prmp->memo );
+        parmFmem( prmp->indexes );
+        parmFmem( prmp->index_work );
+        prmp->memo       = NULL;
+        prmp->indexes    = NULL;
+        prmp->index_work = NULL;
+        prmp->memo_size  = 0;
+        prmp->index_size = 0;
+        prmp->index_alloc     = 0;
+        prmp->index_work_size = 0;
+    }
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Top level parsing. Pull blocks from the reader (if we have one) and
+// parse them, then wrap up...
+//----------------------------------------------------------------------
+static int parmParse(PARSE_BLOCK* parms)
+{
+    int   rc;
+    int   n;
+ 
+ 
+    if( parms->reader != NULL ) {
+        if( parms->in_buf == NULL &&
+            (parms->in_buf = parmGmem(PRMP_READ_BLOCK_SIZE, "RBUF")) == NULL ) {
+            add_error( parms, -3 );
+            return parms->rc = -3;           // Out of memory!
+        }
+ 
+        while( (n = parms->reader->read( parms->reader->ctx, parms->in_buf,
+                                         PRMP_READ_BLOCK_SIZE)) > 0 ) {
+            if( (rc = parse_chars( parms, parms->in_buf, n )) < 0 )
+                return rc;       // Some error during parsing!
+        }
+ 
+        if( n < 0 ) {
+            add_error( parms, -4 );
+            return parms->rc = -4;           // Read error.
+        }
+    }
+ 
+    return finish_chars( parms );
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Point a handle at the parsed nodes...
+//----------------------------------------------------------------------
+static int setHandle(PARSE_BLOCK* parms, PRMP_HANDLE* prmp)
+{
+    prmp->base   = parms->arena.base;
+    prmp->used   = parms->arena.used;
+    prmp->anchor = ANCHOR_AT(parms, parms->top_anchor);
+ 
+    return parmSetBegin( prmp );
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Return a new handle that takes over the arena, trimmed down to what
+// was actually used...
+//----------------------------------------------------------------------
+static int detachHandle(PARSE_BLOCK* parms, void** handle)
+{
+    PRMP_HANDLE* prmp;
+    char* base;
+ 
+    if( (prmp = parmGmem( sizeof(PRMP_HANDLE), "PHND")) == NULL ) {
+        return -3;           // Out of memory!
+    }
+ 
+    if( (base = realloc( parms->arena.base, parms->arena.used)) != NULL ) {
+        parms->arena.base = base;
+        parms->arena.size = parms->arena.used;
+    }
+ 
+    setHandle( parms, prmp );
+    *handle = (void*) prmp;
+ 
+    parms->arena.base = NULL;            // Belongs to the handle now.
+    parms->arena.size = 0;
+    parms->arena.used = 0;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Parse out parameter file and return handle and results. If memname
+// is NULL, then input dataset is not a PDS, but a sequencial file.
+//----------------------------------------------------------------------
+int parmParseFile(void** handle, char* filename)
+{
+    int   rc = 0;
+    FILE* fs;
+    PRMP_READER reader;
+ 
+ 
+    if( (fs = fopen ( filename, "r")) == NULL) {
+        fprintf(stderr, "Could not open configuration file %s\n", filename);
+        return -4;
+    }
+ 
+    parmReaderStream( &reader, fs );
+ 
+    rc = parmParseSource( handle, &reader );
+ 
+    fclose( fs );
+ 
+    return rc;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Parse out parameters from any reader and return handle and results.
+// The reader stays open; the caller closes it when done...
+//----------------------------------------------------------------------
+int parmParseSource(void** handle, PRMP_READER* reader)
+{
+    int   rc = 0;
+    PARSE_BLOCK* parms;
+ 
+ 
+    if( (parms = initParseBlock()) == NULL) {
+        return -16;
+    }
+ 
+    if( (rc = startParseBlock( parms, reader )) == 0 &&
+        (rc = parmParse( parms )) == 0 ) {
+        rc = detachHandle( parms, handle );
+    }
+ 
+    freeParseBlock( parms );
+ 
+    return rc;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmContextCreate() -- Set up a parse context for repeated parsing...
+//----------------------------------------------------------------------
+int parmContextCreate( void** ctx)
+{
+    PRMP_CONTEXT* context;
+ 
+    if( (context = parmGmem( sizeof(PRMP_CONTEXT), "PCTX")) == NULL ) {
+        return -3;           // Out of memory!
+    }
+ 
+    context->handle.in_context = TRUE;
+    *ctx = (void*) context;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmParseFileWith() -- Parse a file with a parse context. The handle
+//                        returned belongs to the context and is only
+//                        good until the next parse with it...
+//----------------------------------------------------------------------
+int parmParseFileWith( void* ctx, void** handle, char* filename)
+{
+    int   rc;
+    int   fd;
+    PRMP_READER reader;
+ 
+    if( (fd = open( filename, O_RDONLY)) < 0 ) {
+        fprintf(stderr, "Could not open configuration file %s\n", filename);
+        return -4;
+    }
+ 
+    parmReaderFd( &reader, fd );
+ 
+    rc = parmParseSourceWith( ctx, handle, &reader );
+ 
+    close( fd );
+ 
+    return rc;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmParseSourceWith() -- Parse from a reader with a parse context...
+//----------------------------------------------------------------------
+int parmParseSourceWith( void* ctx, void** handle, PRMP_READER* reader)
+{
+    PRMP_CONTEXT* context = (PRMP_CONTEXT*) ctx;
+    int   rc;
+ 
+    freeLazy( &context->handle, FALSE );
+ 
+    if( (rc = startParseBlock( &context->parms, reader )) < 0 ||
+        (rc = parmParse( &context->parms )) < 0 ) {
+        return rc;
+    }
+ 
+    setHandle( &context->parms, &context->handle );
+    *handle = (void*) &context->handle;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmParserCreate() -- Set up a parser to be fed with parmFeed(). It
+//                       is a parse context underneath, so it keeps its
+//                       buffers between documents...
+//----------------------------------------------------------------------
+int parmParserCreate( void** parser)
+{
+    PRMP_CONTEXT* context;
+    int   rc;
+ 
+    if( (rc = parmContextCreate( parser )) < 0 )
+        return rc;
+ 
+    context = (PRMP_CONTEXT*) *parser;
+    if( (rc = startParseBlock( &context->parms, NULL )) < 0 ) {
+        parmContextDestroy( context );
+        return rc;
+    }
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmFeed() -- Parse the next len bytes of the document. They can be
+//               cut anywhere, even in the middle of a string...
+//----------------------------------------------------------------------
+int parmFeed( void* parser, const char* buf, int len)
+{
+    PRMP_CONTEXT* context = (PRMP_CONTEXT*) parser;
+    int   rc;
+ 
+    if( context->parms.restart && (rc = startParseBlock( &context->parms, NULL )) < 0 )
+        return rc;
+ 
+    return parse_chars( &context->parms, buf, len );
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmFinish() -- That was the whole document. Return a handle for it
+//                 (free it with parmFree()) and get ready for the next
+//                 document...
+//----------------------------------------------------------------------
+int parmFinish( void* parser, void** handle)
+{
+    PRMP_CONTEXT* context = (PRMP_CONTEXT*) parser;
+    int   rc;
+ 
+    if( context->parms.restart && (rc = startParseBlock( &context->parms, NULL )) < 0 )
+        return rc;
+ 
+    context->parms.reader = NULL;
+ 
+    if( (rc = parmParse( &context->parms )) == 0 )
+        rc = detachHandle( &context->parms, handle );
+ 
+    // Start over with the next parmFeed(), leaving any errors for
+    // parmGetError() until then...
+    context->parms.restart = TRUE;
+ 
+    return rc;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmParserDestroy() -- Free a parser...
+//----------------------------------------------------------------------
+int parmParserDestroy( void* parser)
+{
+    return parmContextDestroy( parser );
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmSetRecovery() -- For a context or parser. Instead of stopping at
+//                      the first syntax error, collect up to max_errors
+//                      of them, skipping to the next line or } after
+//                      each one. 0 turns recovery off again...
+//----------------------------------------------------------------------
+int parmSetRecovery( void* ctx, int max_errors)
+{
+    PARSE_BLOCK* parms = &((PRMP_CONTEXT*) ctx)->parms;
+    PRMP_ERROR*  errors;
+    int   slots;
+ 
+    if( max_errors < 0 )
+        return -1;
+ 
+    slots = max_errors > 0 ? max_errors : 1;
+    if( (errors = realloc( parms->errors, slots * sizeof(PRMP_ERROR))) == NULL )
+        return -3;           // Out of memory!
+ 
+    parms->errors    = errors;
+    parms->error_max = max_errors;
+    if( parms->error_count > slots )
+        parms->error_count = slots;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmGetError() -- Return the number of errors the last parse with a
+//                   context or parser found, and if error isn't NULL,
+//                   copy error n (starting at 0) to it...
+//----------------------------------------------------------------------
+int parmGetError( void* ctx, int n, PRMP_ERROR* error)
+{
+    PARSE_BLOCK* parms = &((PRMP_CONTEXT*) ctx)->parms;
+ 
+    if( error != NULL ) {
+        if( n < 0 || n >= parms->error_count )
+            return -1;
+        *error = parms->errors[n];
+    }
+ 
+    return parms->error_count;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmContextDestroy() -- Free a parse context and its last handle...
+//----------------------------------------------------------------------
+int parmContextDestroy( void* ctx)
+{
+    PRMP_CONTEXT* context = (PRMP_CONTEXT*) ctx;
+ 
+    releaseParseBlock( &context->parms );
+    freeLazy( &context->handle, TRUE );
+    parmFmem( context );
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmFree() -- Free a handle and its parsed nodes. Handles that belong
+//               to a parse context are freed along with the context...
+//----------------------------------------------------------------------
+int parmFree( void* handle)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+ 
+    if( prmp == NULL || prmp->in_context )
+        return 0;
+ 
+    if( prmp->shm_base != NULL ) {      // Attached to a shared segment?
+        munmap( prmp->shm_base, prmp->shm_size );
+        parmFmem( prmp );
+        return 0;
+    }
+ 
+    freeLazy( prmp, TRUE );
+    parmFmem( prmp->base );
+    parmFmem( prmp );
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmSetBegin() -- Prepare for traversing the parameters. Just
+//                       reset pointers in handle.
+//----------------------------------------------------------------------
+int parmSetBegin(    void* handle)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+ 
+    prmp->cur_anchor       = NULL;
+    prmp->cur_node         = NULL;
+    prmp->node_stack_index = 0;
+ 
+    return 0;
+}
+ 
+ 
+#define HNODE(prmp, off)    ((off) ? (PRMP_NODE*) ARENA_PTR((prmp)->base, off) : NULL)
+#define HANCHOR(prmp, off)  ((off) ? (PRMP_ANCHOR*) ARENA_PTR((prmp)->base, off) : NULL)
+ 
+ 
+//----------------------------------------------------------------------
+// A growing string, for building decoded values...
+//----------------------------------------------------------------------
+typedef struct _str_buf {
+    char*  str;
+    size_t len;
+    size_t size;
+} STR_BUF;
+ 
+static int strBufAdd( STR_BUF* sb, const char* s, size_t len)
+{
+    char*  str;
+    size_t size;
+ 
+    if( sb->len + len + 1 > sb->size ) {
+        for( size = sb->size ? sb->size * 2 : 64; size < sb->len + len + 1; size *= 2 );
+        if( (str = realloc( sb->str, size)) == NULL )
+            return -3;           // Out of memory!
+        sb->str  = str;
+        sb->size = size;
+    }
+ 
+    memcpy( sb->str + sb->len, s, len);
+    sb->len += len;
+    sb->str[sb->len] = 0;
+ 
+    return 0;
+}
+ 
+ 
+static int resolveValue( PRMP_HANDLE* prmp, PRMP_NODE* node, char** value);
+ 
+ 
+//----------------------------------------------------------------------
+// Find the string node whose dotted path is rest, starting at anchor.
+// Keys can have dots in them too, so a key matches if it is all of rest,
+// or the part of it before a dot and a level we can carry on into. The
+// candidates are tried in file order, the first string found wins...
+//----------------------------------------------------------------------
+static PRMP_NODE* findRef( PRMP_HANDLE* prmp, PRMP_ANCHOR* anchor, const char* rest)
+{
+    PRMP_NODE* node;
+    PRMP_NODE* found;
+    char*  key;
+    size_t key_len;
+ 
+    for( node = HNODE(prmp, anchor->first); node != NULL; node = HNODE(prmp, PRMP_NODE_NEXT(node)) ) {
+        key     = slotString( prmp->base, &node->key);
+        key_len = strlen( key );
+        if( strncmp( rest, key, key_len) != 0 )
+            continue;
+ 
+        if( rest[key_len] == 0 && PRMP_NODE_TYPE(node) == PRMP_STRING )
+            return node;
+        if( rest[key_len] == '.' && PRMP_NODE_TYPE(node) == PRMP_NEXTLEVEL &&
+            (found = findRef( prmp, HANCHOR(prmp, node->value.ool.off), rest + key_len + 1)) != NULL )
+            return found;
+    }
+ 
+    return NULL;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Look up a ${name} reference. A dotted name is a path of keys from
+// the top level, matched the same way as parmExport() paths; if there
+// is no such key we try the environment. Anything else expands to
+// nothing...
+//----------------------------------------------------------------------
+static int resolveRef( PRMP_HANDLE* prmp, char* name, STR_BUF* sb)
+{
+    PRMP_NODE* node = findRef( prmp, prmp->anchor, name);
+    char* value;
+    int   rc;
+ 
+    if( node != NULL && PRMP_NODE_TYPE(node) == PRMP_STRING ) {
+        if( (rc = resolveValue( prmp, node, &value)) < 0 )
+            return rc;
+        return strBufAdd( sb, value, strlen(value));
+    }
+ 
+    if( (value = getenv( name )) != NULL )
+        return strBufAdd( sb, value, strlen(value));
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Decode escapes (\" \' \\ \n \r \t \xNN) and expand ${} references in
+// a raw value, from scratch into sb. Unknown escapes are left alone...
+//----------------------------------------------------------------------
+static int decodeValue( PRMP_HANDLE* prmp, char* raw, int flags, STR_BUF* sb)
+{
+    char* p = raw;
+    char* end;
+    char  c;
+    int   n;
+    int   rc = 0;
+ 
+    while( *p != 0 && rc == 0 ) {
+ 
+        if( *p == '\\' && (flags & PRMP_SLOT_ESC) && p[1] != 0 ) {
+            if( (n = decodeEscape( p, &c)) == 0 ) {
+                rc = strBufAdd( sb, p, 2);          // Not an escape we know.
+                p += 2;
+            } else {
+                if( c != 0 )                         // A NUL would cut the value short.
+                    rc = strBufAdd( sb, &c, 1);
+                p += n;
+            }
+ 
+        } else if( *p == '$' && p[1] == '{' && (flags & PRMP_SLOT_INTERP) &&
+                   (end = strchr( p + 2, '}')) != NULL ) {
+            *end = 0;                        // Borrow the raw string for the name.
+            rc = resolveRef( prmp, p + 2, sb);
+            *end = '}';
+            p = end + 1;
+ 
+        } else {
+            rc = strBufAdd( sb, p++, 1);
+        }
+    }
+ 
+    return rc;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Return a node's string value, decoding it on first use. The decoded
+// value is remembered in the handle's memo and the slot points at it
+// from then on. A value that refers back to itself gets -5...
+//----------------------------------------------------------------------
+static int resolveValue( PRMP_HANDLE* prmp, PRMP_NODE* node, char** value)
+{
+    PRMP_SLOT* slot = &node->value;
+    STR_BUF    sb   = { NULL, 0, 0 };
+    char**     memo;
+    int        rc;
+ 
+    if( (slot->ool.tag & PRMP_SLOT_OOL) && (slot->ool.tag & PRMP_SLOT_CYCLE) )
+        return -5;               // Published with a reference cycle.
+ 
+    if( !(slot->ool.tag & PRMP_SLOT_OOL) ||
+        !(slot->ool.tag & PRMP_SLOT_LAZY) ) {
+        *value = slotString( prmp->base, slot);
+        return 0;
+    }
+ 
+    if( slot->ool.tag & PRMP_SLOT_MEMO ) {
+        *value = prmp->memo[slot->ool.off];
+        return 0;
+    }
+ 
+    if( slot->ool.tag & PRMP_SLOT_BUSY )
+        return -5;               // Reference cycle!
+ 
+    slot->ool.tag |= PRMP_SLOT_BUSY;
+    if( (rc = decodeValue( prmp, prmp->base + slot->ool.off, slot->ool.tag, &sb)) == 0 )
+        rc = strBufAdd( &sb, "", 0);         // Make sure we have a string at all.
+    slot->ool.tag &= ~PRMP_SLOT_BUSY;
+ 
+    if( rc == 0 && prmp->memo_count == prmp->memo_size ) {
+        if( (memo = realloc( prmp->memo, (prmp->memo_size ? prmp->memo_size * 2 : 16) *
+                                         sizeof(char*))) == NULL ) {
+            rc = -3;             // Out of memory!
+        } else {
+            prmp->memo      = memo;
+            prmp->memo_size = prmp->memo_size ? prmp->memo_size * 2 : 16;
+        }
+    }
+ 
+    if( rc < 0 ) {
+        parmFmem( sb.str );
+        return rc;
+    }
+ 
+    prmp->memo[prmp->memo_count] = sb.str;
+    slot->ool.off  = prmp->memo_count++;
+    slot->ool.tag |= PRMP_SLOT_MEMO;
+    *value = sb.str;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmRoot() -- Return the arena and top-level anchor of a handle, for
+//               walking the nodes directly (see parmnode.h)...
+//----------------------------------------------------------------------
+int parmRoot( void* handle, char** base, PRMP_ANCHOR** anchor)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+ 
+    *base   = prmp->base;
+    *anchor = prmp->anchor;
+ 
+    return 0;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmNodeValue() -- Return the value of a string node, decoding it if
+//                    need be. Does not touch the handle's cursor...
+//----------------------------------------------------------------------
+int parmNodeValue( void* handle, PRMP_NODE* node, char** value)
+{
+    return resolveValue( (PRMP_HANDLE*) handle, node, value);
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Return the value of the current node (if it is a string) and its type...
+//----------------------------------------------------------------------
+static int curValue( PRMP_HANDLE* prmp, char** value)
+{
+    int rc;
+ 
+    if( PRMP_NODE_TYPE(prmp->cur_node) == PRMP_STRING ) {
+        if( (rc = resolveValue( prmp, prmp->cur_node, value)) < 0 )
+            return rc;
+        return PRMP_STRING;
+    }
+ 
+    return PRMP_NODE_TYPE(prmp->cur_node);
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmGetNext() --
+//----------------------------------------------------------------------
+int parmGetNext(     void* handle, char** key, char** value)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+ 
+    if( prmp->cur_anchor == NULL ) {
+        prmp->cur_anchor = prmp->anchor;
+        prmp->cur_node   = NULL;
+    }
+ 
+    if( prmp->cur_node   == NULL ) {
+        if( (prmp->cur_node = HNODE(prmp, prmp->cur_anchor->first)) == NULL)
+            return PRMP_END;
+    } else {
+        if( (prmp->cur_node = HNODE(prmp, PRMP_NODE_NEXT(prmp->cur_node))) == NULL)
+            return PRMP_END;
+    }
+ 
+    *key = slotString( prmp->base, &prmp->cur_node->key);
+    return curValue( prmp, value);
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmLevelDown() -- Go down a level. We can only go down a level
+//                        if the current node has a next level, other-
+//                        wise, a -1 is returned. So that we can later
+//                        get back to the node we were on, we keep a
+//                        stack of pointers to nodes...
+//----------------------------------------------------------------------
+int parmLevelDown(   void* handle )
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+ 
+    if( prmp->cur_node != NULL && PRMP_NODE_TYPE(prmp->cur_node) == PRMP_NEXTLEVEL &&
+        prmp->node_stack_index < PRMP_MAX_LEVELS ) {
+        prmp->cur_anchor = HANCHOR(prmp, prmp->cur_node->value.ool.off);
+        prmp->node_stack[prmp->node_stack_index++] = prmp->cur_node;
+        prmp->cur_node   = NULL;
+        return 0;
+    }
+ 
+    return -1;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmLevelUp() -- Go up a level...
+//----------------------------------------------------------------------
+int parmLevelUp(     void* handle )
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+ 
+    if( prmp->cur_anchor->up != 0 && prmp->node_stack_index > 0 ) {
+        prmp->cur_anchor = HANCHOR(prmp, prmp->cur_anchor->up);
+        prmp->cur_node   = prmp->node_stack[--prmp->node_stack_index];
+        return 0;
+    }
+ 
+    return -1;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmFindKey() -- Find first key within a level...
+//----------------------------------------------------------------------
+int parmFindKey( void* handle, char* key, char** value)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+ 
+    // If we haven't done a search yet, then start at the top level...
+    if( prmp->cur_anchor == NULL ) {
+        prmp->cur_anchor = prmp->anchor;
+        prmp->cur_node   = NULL;
+    }
+ 
+    // First node to check within this level...
+    prmp->cur_node = HNODE(prmp, prmp->cur_anchor->first);
+ 
+    // Go through the nodes at this level and find first that matches...
+    while( prmp->cur_node != NULL ) {
+ 
+        if( strcmp(slotString( prmp->base, &prmp->cur_node->key), key) == 0 ) {
+            return curValue( prmp, value);
+        }
+        prmp->cur_node = HNODE(prmp, PRMP_NODE_NEXT(prmp->cur_node));
+    }
+ 
+    return PRMP_END;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmFindNextKey() -- Find next key within a level...
+//----------------------------------------------------------------------
+int parmFindNextKey( void* handle, char* key, char** value)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+ 
+    // If we haven't done a search yet, then start at the top level...
+    if( prmp->cur_anchor == NULL ) {
+        prmp->cur_anchor = prmp->anchor;
+        prmp->cur_node   = NULL;
+    }
+ 
+    // Next node to check. Its possible we are to start from the beginning...
+    if( prmp->cur_node   == NULL ) {
+        prmp->cur_node = HNODE(prmp, prmp->cur_anchor->first);
+    } else {
+        prmp->cur_node = HNODE(prmp, PRMP_NODE_NEXT(prmp->cur_node));
+    }
+ 
+    // Go through rest of nodes at this level that matches...
+    while( prmp->cur_node != NULL ) {
+        if( strcmp(slotString( prmp->base, &prmp->cur_node->key), key) == 0 ) {
+            return curValue( prmp, value);
+        }
+        prmp->cur_node = HNODE(prmp, PRMP_NODE_NEXT(prmp->cur_node));
+    }
+ 
+    return PRMP_END;
+}
+ 
+ 
+//----------------------------------------------------------------------
+// Merge sort node offsets by key. Merge sort is stable, so duplicate
+// keys stay in file order...
+//----------------------------------------------------------------------
+static void sortByKey( char* base, uint32_t* offs, uint32_t* work, uint32_t n)
+{
+    uint32_t half = n / 2;
+    uint32_t i = 0, j = half, k = 0;
+ 
+    if( n < 2 )
+        return;
+ 
+    sortByKey( base, offs, work, half);
+    sortByKey( base, offs + half, work, n - half);
+ 
+    while( i < half && j < n ) {
+        if( strcmp( slotString( base, &((PRMP_NODE*) (base + offs[j]))->key),
+                    slotString( base, &((PRMP_NODE*) (base + offs[i]))->key)) < 0 )
+            work[k++] = offs[j++];
+        else
+            work[k++] = offs[i++];
+    }
+    while( i < half )
+        work[k++] = offs[i++];
+    while( j < n )
+        work[k++] = offs[j++];
+ 
+    memcpy( offs, work, n * sizeof(uint32_t));
+}
  
  
 //----------------------------------------------------------------------
-// Routine to allocate and initialize PARSE_BLOCK...
+// Return the sorted key index of a level, building it the first time.
+// An index is a count followed by that many node offsets...
 //----------------------------------------------------------------------
-static PARSE_BLOCK* initParseBlock()
+static uint32_t* levelIndex( PRMP_HANDLE* prmp, PRMP_ANCHOR* anchor)
 {
-    PARSE_BLOCK* parms;
- 
-    parms = parmGmem( sizeof(PARSE_BLOCK), "PRMP");  // Allocate a parse blok.
+    PRMP_NODE* node;
+    uint32_t*  index;
+    uint32_t*  work;
+    uint32_t** indexes;
+    uint32_t   n = 0;
+ 
+    if( prmp->shm_base != NULL )         // Shared segments come with every index built.
+        return (uint32_t*) (prmp->base + anchor->index);
+ 
+    if( anchor->index != 0 )
+        return prmp->indexes[anchor->index - 1] + 1;
+ 
+    if( prmp->index_count == prmp->index_size ) {
+        if( (indexes = realloc( prmp->indexes, (prmp->index_size ? prmp->index_size * 2 : 16) *
+                                               sizeof(uint32_t*))) == NULL )
+            return NULL;         // Out of memory!
+        prmp->indexes    = indexes;
+        prmp->index_size = prmp->index_size ? prmp->index_size * 2 : 16;
+    }
  
-    // Allocate memory for a workarea to be used for parsing strings...
-    if(( parms->str_wrk = parmGmem(PRMP_STRING_WORK_SIZE, "PSTR")) == NULL) {
-        return (PARSE_BLOCK*) -1;
+    for( node = HNODE(prmp, anchor->first); node != NULL; node = HNODE(prmp, PRMP_NODE_NEXT(node)) )
+        n++;
+ 
+    // Each index buffer starts with its capacity. Buffers left over from
+    // an earlier parse are reused when they are big enough...
+    index = NULL;
+    if( prmp->index_count < prmp->index_alloc ) {
+        index = prmp->indexes[prmp->index_count];
+        if( index[0] < n + 1 ) {
+            if( (index = realloc( index, (n + 2) * sizeof(uint32_t))) == NULL )
+                return NULL;     // Out of memory!
+            index[0] = n + 1;
+            prmp->indexes[prmp->index_count] = index;
+        }
+    } else {
+        if( (index = parmGmem( (n + 2) * sizeof(uint32_t), "PIDX")) == NULL )
+            return NULL;         // Out of memory!
+        index[0] = n + 1;
+        prmp->indexes[prmp->index_alloc++] = index;
     }
  
-    // Allocate first gtms temp storage for top-level anchor block for our parsed nodes...
-    if( (parms->top_anchor = parmGtms( &parms->gtms, sizeof(PRMP_ANCHOR), "PANC")) == NULL ) {
-        return (PARSE_BLOCK*) -1;
+    if( prmp->index_work_size < n + 1 ) {
+        if( (work = realloc( prmp->index_work, (n + 1) * sizeof(uint32_t))) == NULL )
+            return NULL;         // Out of memory!
+        prmp->index_work      = work;
+        prmp->index_work_size = n + 1;
     }
  
-    parms->str_wrk_len = PRMP_STRING_WORK_SIZE;
+    index++;                     // Past the capacity.
+    index[0] = n;
+    n = 0;
+    for( node = HNODE(prmp, anchor->first); node != NULL; node = HNODE(prmp, PRMP_NODE_NEXT(node)) )
+        index[++n] = (uint32_t) ((char*) node - prmp->base);
+ 
+    sortByKey( prmp->base, index + 1, prmp->index_work, n);
+ 
+    anchor->index = ++prmp->index_count;
  
-    return parms;
+    return index;
 }
  
  
 //----------------------------------------------------------------------
-// Routine to clean up and free PARSE_BLOCK...
+// Binary search a sorted index for the first key not less than key, or
+// with upper, the first key greater than key. If len is not 0, only
+// the first len bytes of the keys are compared...
 //----------------------------------------------------------------------
-static int freeParseBlock(PARSE_BLOCK* parms)
+static uint32_t* indexBound( PRMP_HANDLE* prmp, uint32_t* first, uint32_t n,
+                             char* key, size_t len, BOOL upper)
 {
-    if( parms->str_wrk )
-        parmFmem(parms->str_wrk);
- 
-    parmFmem( (void*) parms);
+    uint32_t half;
+    char*    k;
+    int      cmp;
+ 
+    while( n > 0 ) {
+        half = n / 2;
+        k    = slotString( prmp->base, &((PRMP_NODE*) (prmp->base + first[half]))->key);
+        cmp  = len ? strncmp( k, key, len) : strcmp( k, key);
+        if( cmp < 0 || (upper && cmp == 0) ) {
+            first += half + 1;
+            n     -= half + 1;
+        } else {
+            n = half;
+        }
+    }
  
-    return 0;
+    return first;
 }
  
  
- 
-//-----------------------------------------------------------------------
-// Get next character from file. ignore comments if not in a quoted str...
-//-----------------------------------------------------------------------
-static unsigned char next_char( PARSE_BLOCK* parms, BOOL lookahead, BOOL in_quotes )
+//----------------------------------------------------------------------
+// Set up an iterator over the current level's sorted index...
+//----------------------------------------------------------------------
+static uint32_t* iterLevel( PRMP_HANDLE* prmp, PRMP_ITER* iter)
 {
-    unsigned char c;
-
-
-    while( 1 ) {
-        // do we need to get first or next line in file?
-        if( !parms->have_line ) {
-            int len;
-
-            if( parms->len == 1 ) {  // If we had looked ahead to end of line?
-                if( !lookahead )
-                    parms->len = 0;
-                return ' ';
-            }
+    uint32_t* index;
  
-            if( parms->is_eof )
-                return 255;             // Indicate end of file.
- 
-            if( (len = callbackIo( parms )) < 0) {
-                // There needs to be a differenciation between error and eof?
-                // For now, assume eof (-4)
-                parms->is_eof = TRUE;
-                return 255;             // return with error code.
-            }
- 
-            if( len == 0 ) {            // Nothing more to read in. (EOF)?
-                parms->is_eof = TRUE;
-                return 255;             // Indicate end of file.
-            }
-
-            parms->have_line = TRUE;
+    // If we haven't done a search yet, then start at the top level...
+    if( prmp->cur_anchor == NULL ) {
+        prmp->cur_anchor = prmp->anchor;
+        prmp->cur_node   = NULL;
+    }
  
-            parms->buf = parms->next_buf;
-            parms->len = len;
-        }
+    if( (index = levelIndex( prmp, prmp->cur_anchor )) == NULL )
+        return NULL;
  
-        // Are we at end of current line or start of comment?
-        // If so, then go to next line...
-        if( parms->len == 0 || (*parms->buf == '#' && !in_quotes)) {
-
-            parms->have_line = FALSE;
+    iter->handle = prmp;
+    iter->next   = index + 1;
+    iter->end    = index + 1 + index[0];
  
-            if ( lookahead )
-                parms->len = 1;
+    return index;
+}
  
-            // Return with just a space...
-            return ' ';
-        }
  
-        c = *parms->buf;
+//----------------------------------------------------------------------
+// parmFindPrefix() -- Find all keys within a level that start with
+//                     prefix, in key order. Returns how many...
+//----------------------------------------------------------------------
+int parmFindPrefix( void* handle, char* prefix, PRMP_ITER* iter)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+    uint32_t*    index;
+    size_t       len = strlen( prefix );
  
-        if (!lookahead) {
-            parms->buf++;
-            parms->len--;
-        }
+    if( (index = iterLevel( prmp, iter )) == NULL )
+        return -3;               // Out of memory!
  
-        return c;
+    if( len > 0 ) {
+        iter->next = indexBound( prmp, index + 1, index[0], prefix, len, FALSE);
+        iter->end  = indexBound( prmp, index + 1, index[0], prefix, len, TRUE);
     }
+ 
+    return (int) ((uint32_t*) iter->end - (uint32_t*) iter->next);
 }
  
  
+//----------------------------------------------------------------------
+// parmFindRange() -- Find all keys within a level from lo up to (but
+//                    not including) hi, in key order. A NULL lo or hi
+//                    leaves that end open. Returns how many...
+//----------------------------------------------------------------------
+int parmFindRange( void* handle, char* lo, char* hi, PRMP_ITER* iter)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+    uint32_t*    index;
+ 
+    if( (index = iterLevel( prmp, iter )) == NULL )
+        return -3;               // Out of memory!
+ 
+    if( lo != NULL )
+        iter->next = indexBound( prmp, index + 1, index[0], lo, 0, FALSE);
+    if( hi != NULL )
+        iter->end  = indexBound( prmp, index + 1, index[0], hi, 0, FALSE);
+    if( iter->end < iter->next )
+        iter->end = iter->next;
  
-//-----------------------------------------------------------------------
-// Get next string. We collect next string and put in our str_wrk area...
-//-----------------------------------------------------------------------
-static int next_string( PARSE_BLOCK* parms, BOOL isLookingForKey )
+    return (int) ((uint32_t*) iter->end - (uint32_t*) iter->next);
+}
+ 
+ 
+//----------------------------------------------------------------------
+// parmIterNext() -- Return the next key/value found by parmFindPrefix()
+//                   or parmFindRange(). The node becomes the current
+//                   one, so parmLevelDown() works on it...
+//----------------------------------------------------------------------
+int parmIterNext( PRMP_ITER* iter, char** key, char** value)
 {
-    char  quote_char;
-    BOOL  in_quotes = FALSE;
-    unsigned char c;
-
-    parms->str_len = 0;    // Reset string length.
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) iter->handle;
+    uint32_t*    next = (uint32_t*) iter->next;
  
-    // Gooble up any leading spaces before something starts...
-    while( (c = next_char( parms, FALSE, FALSE )) != 255 &&
-                           ( c == ' ' ||      // If leading space
-                             c == 0 ) );      // Or end-of-line.
-
-    while(1) {
+    if( next >= (uint32_t*) iter->end )
+        return PRMP_END;
  
-        if( parms->is_eof == TRUE ) {  // End of file?
-            if( in_quotes )            // Are we also in qoutes?
-                return -2;             // Yes.  So, syntax error!
-            break;                     // Otherwise, then we are done.
-        }
+    iter->next     = next + 1;
+    prmp->cur_node = HNODE(prmp, *next);
  
-        // Check for start/end of quoted string...
-        if( in_quotes ) {                     // Are we already in quotes?
-            if( c == quote_char ) {           // Yes, and is this ending quote?
-                break;                        // Yes, so we have a string now.
-            }
+    *key = slotString( prmp->base, &prmp->cur_node->key);
+    return curValue( prmp, value);
+}
  
-        // Check for starting a quote...
-        } else if ( c == '"' || c == '\'' ) {
-            if( parms->str_len > 0 )          // Already started to collect a string?
-                return -2;                    // Yes, so, error!
-            quote_char = c;                   // Otherwise, starting a quoted string.
-            in_quotes = TRUE;
-            if( (c = next_char( parms, FALSE, TRUE )) == 255) // Skip over quote. EOF?
-                return c;                     // Yes. Return with EOF.
- 
-        // Check for normal end of string...
-        } else if ( c == ' ' || c == ':' || c == '{' || c == '}' ) {
-            break;                     // Break out of loop.
-        }
  
-        // Otherwise, collect another character of the string...
-        if( parms->str_len >= (parms->str_wrk_len - 1) )  // check if room.
-            return -1;                                    // Too big!
+//----------------------------------------------------------------------
+// Exporting is done in two passes over the same nodes: the first counts
+// entries and path bytes so the table can be allocated in one go, the
+// second fills it in...
+//----------------------------------------------------------------------
+typedef struct _export_work {
+    PRMP_HANDLE*        prmp;
+    int                 flags;
+    int                 count;           // Entries so far.
+    size_t              chars;           // Path bytes so far.
+    PRMP_EXPORT_ENTRY*  entry;           // Table to fill in (NULL when counting).
+    char*               strings;         // Where the paths go.
+} EXPORT_WORK;
  
-        parms->str_wrk[parms->str_len++] = c;
  
-        c = next_char( parms, FALSE, in_quotes );
+//----------------------------------------------------------------------
+// Export a node and everything under it. Its path is prefix.key...
+//----------------------------------------------------------------------
+static int exportNode( EXPORT_WORK* w, PRMP_NODE* node, int depth, int parent,
+                       const char* prefix, size_t prefix_len)
+{
+    PRMP_HANDLE* prmp  = w->prmp;
+    PRMP_EXPORT_ENTRY* e;
+    PRMP_NODE* child;
+    char*  key      = slotString( prmp->base, &node->key);
+    size_t key_len  = strlen( key );
+    size_t path_len = prefix_len ? prefix_len + 1 + key_len : key_len;
+    char*  path     = NULL;
+    char*  value    = NULL;
+    int    index    = w->count++;
+    int    rc;
+ 
+    if( PRMP_NODE_TYPE(node) == PRMP_STRING && (rc = resolveValue( prmp, node, &value)) < 0 )
+        return rc;
+ 
+    if( !(w->flags & PRMP_EXPORT_NOPATH) ) {
+        if( w->entry != NULL ) {
+            path = w->strings + w->chars;
+            if( prefix_len ) {
+                memcpy( path, prefix, prefix_len);
+                path[prefix_len] = '.';
+            }
+            memcpy( path + path_len - key_len, key, key_len + 1);
+        }
+        w->chars += path_len + 1;
     }
  
-    // NULL terminate string in string workarea...
-    parms->str_wrk[parms->str_len] = 0;
+    if( w->entry != NULL ) {
+        e = &w->entry[index];
+        e->path   = path;
+        e->key    = key;
+        e->value  = value;
+        e->type   = PRMP_NODE_TYPE(node);
+        e->depth  = depth;
+        e->parent = parent;
+    }
  
-    // So, now, return terminating character if it is :, {, }
-    // Gooble up any leading spaces before something else starts. We will lookahead.
-    while( c == ' ' && !parms->is_eof) {
-        if( (c = next_char( parms, TRUE, FALSE )) == 255 )     // Peek at next char.
-            return c;                                          // If error, return.
-        if( c == ':' || c == '{' || c == '}' ) {
-            if( (c = next_char( parms, FALSE, FALSE )) == 255) // Actually get it.
-                return c;                                      // If error, return.
-            break;
-        }
-        if( c != ' ' ) {                                       // Anything else,
-            break;                                             // Leave for next time.
+    if( PRMP_NODE_TYPE(node) == PRMP_NEXTLEVEL ) {
+        for( child = HNODE(prmp, HANCHOR(prmp, node->value.ool.off)->first); child != NULL;
+             child = HNODE(prmp, PRMP_NODE_NEXT(child)) ) {
+            if( (rc = exportNode( w, child, depth + 1, index, path, path_len)) < 0 )
+                return rc;
         }
-        if( (c = next_char( parms, FALSE, FALSE )) == 255)     // Gooble spaces.
-            return c;                                          // If error, return.
-    }
-
-    if( c == ':' || c == '{' || c == '}' || c == 255 ) {
-        return c;
     }
  
-    return ' ';
+    return 0;
 }
  
  
- 
 //----------------------------------------------------------------------
-// Parse out key...
+// Export every node of a level...
 //----------------------------------------------------------------------
-static int parse_key( PARSE_BLOCK* parms, PRMP_NODE* node)
+static int exportLevel( EXPORT_WORK* w, PRMP_ANCHOR* anchor, const char* prefix, size_t prefix_len)
 {
-    unsigned char term_char;
+    PRMP_NODE* node;
+    int   rc;
  
-    if( (term_char = next_string( parms, TRUE )) < 0) {
-        return term_char;    // Return with error code.
-    }
-
-    //End of file?
-    if( term_char == 255 ) {
-        return term_char;
+    for( node = HNODE(w->prmp, anchor->first); node != NULL; node = HNODE(w->prmp, PRMP_NODE_NEXT(node)) ) {
+        if( (rc = exportNode( w, node, 0, -1, prefix, prefix_len)) < 0 )
+            return rc;
     }
  
-    // Keys should end with :.  Anything else should be an error!
-    if( term_char != ':' )
-        return -2;                  // If there was a key parsed out, then error!
+    return 0;
+}
  
-    if( parms->str_len == 0)
-        return term_char;           // Let higher level deal with it.
  
-    if( (node->key = parmGtms( &parms->gtms, parms->str_len + 1, "PSTR")) == NULL ) {
-        return -3;           // Out of memory!
+//----------------------------------------------------------------------
+// Export the nodes whose dotted path is path, rest being the part of it
+// still to match at this level. Since keys can have dots in them too, a
+// key matches if it is all of rest or the part of it before a dot...
+//----------------------------------------------------------------------
+static int exportMatch( EXPORT_WORK* w, PRMP_ANCHOR* anchor, const char* path, const char* rest)
+{
+    PRMP_NODE* node;
+    char*  key;
+    size_t key_len;
+    int    rc = 0;
+ 
+    for( node = HNODE(w->prmp, anchor->first); node != NULL && rc == 0;
+         node = HNODE(w->prmp, PRMP_NODE_NEXT(node)) ) {
+        key     = slotString( w->prmp->base, &node->key);
+        key_len = strlen( key );
+        if( strncmp( rest, key, key_len) != 0 )
+            continue;
+ 
+        if( rest[key_len] == 0 )
+            rc = exportNode( w, node, 0, -1, path, rest > path ? (size_t) (rest - path - 1) : 0);
+        else if( rest[key_len] == '.' && PRMP_NODE_TYPE(node) == PRMP_NEXTLEVEL )
+            rc = exportMatch( w, HANCHOR(w->prmp, node->value.ool.off), path, rest + key_len + 1);
     }
  
-    memcpy( node->key, parms->str_wrk, parms->str_len);
- 
-    return 0;
+    return rc;
 }
  
  
- 
 //----------------------------------------------------------------------
-// Parse out a value (which could recursively parse next level)...
+// One pass of an export...
 //----------------------------------------------------------------------
-static int parse_value( PARSE_BLOCK* parms, PRMP_NODE* node)
+static int exportPass( EXPORT_WORK* w, char* path, const char* prefix, size_t prefix_len)
 {
-    unsigned char term_char;
-    int  rc;
+    PRMP_HANDLE* prmp = w->prmp;
  
-    if( (term_char = next_string( parms, FALSE )) < 0) {
-        return term_char;    // Return with error code.
-    }
-
-    //End of file?
-    if( term_char == 255 ) {
-        return term_char;
+    if( path == NULL ) {
+        if( prmp->cur_node != NULL )
+            return exportNode( w, prmp->cur_node, 0, -1, prefix, prefix_len);
+        return exportLevel( w, prmp->cur_anchor ? prmp->cur_anchor : prmp->anchor,
+                            prefix, prefix_len);
     }
  
-    if( term_char == '{' )  {
+    if( *path == 0 )
+        return exportLevel( w, prmp->anchor, "", 0);
  
-        if( parms->str_len > 0 )   // Did we parse out a string?
-            return -2;             // Then syntax error!
-        if( (node->nextlevel = parmGtms( &parms->gtms, sizeof(PRMP_ANCHOR), "PANC")) == NULL ) {
-            return -3;           // Out of memory!
-        }
-        node->nextlevel->up = parms->current_anchor;
-        node->type = PRMP_NEXTLEVEL;
+    return exportMatch( w, prmp->anchor, path, path);
+}
  
-        if( (rc = parmParseNode( parms, node->nextlevel )) < 0) {
-            return rc;           // Some error during parsing!
-        }
  
-    } else {
+//----------------------------------------------------------------------
+// parmExport() -- Return the key/value pairs at path (dotted keys from
+//                 the top, "" for everything) and everything under
+//                 them as a flat table in depth-first order. With a
+//                 NULL path, export the node the cursor is on, or the
+//                 whole level if it isn't on one. The cursor is left
+//                 alone. Returns the number of entries; free the table
+//                 with parmFreeExport()...
+//----------------------------------------------------------------------
+int parmExport( void* handle, char* path, int flags, PRMP_EXPORT** out)
+{
+    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+    PRMP_EXPORT* table  = NULL;
+    EXPORT_WORK  w;
+    STR_BUF      prefix = { NULL, 0, 0 };
+    char*  key;
+    int    rc = 0;
+    int    i;
+ 
+    memset( &w, 0, sizeof(w));
+    w.prmp  = prmp;
+    w.flags = flags;
+ 
+    // Exporting from the cursor, the levels we went down through make up
+    // the start of the paths...
+    if( path == NULL && !(flags & PRMP_EXPORT_NOPATH) ) {
+        for( i = 0; i < prmp->node_stack_index && rc == 0; i++ ) {
+            key = slotString( prmp->base, &prmp->node_stack[i]->key);
+            if( (i > 0 && (rc = strBufAdd( &prefix, ".", 1)) < 0) ||
+                (rc = strBufAdd( &prefix, key, strlen(key))) < 0 )
+                break;
+        }
+    }
  
-        if( parms->str_len <= 0 )    // No string?  Then we don't have a value. Error!
-            return -2;               // Syntax error.
+    if( rc == 0 )
+        rc = exportPass( &w, path, prefix.str, prefix.len);
  
-        node->type = PRMP_STRING;
-        if( (node->value = parmGtms( &parms->gtms, parms->str_len + 1, "PSTR")) == NULL ) {
-            return -3;           // Out of memory!
+    if( rc == 0 ) {
+        if( (table = parmGmem( sizeof(PRMP_EXPORT) + w.count * sizeof(PRMP_EXPORT_ENTRY) +
+                                w.chars, "PEXP")) == NULL ) {
+            rc = -3;             // Out of memory!
+        } else {
+            table->count   = w.count;
+            table->entries = (PRMP_EXPORT_ENTRY*) (table + 1);
+            w.entry   = table->entries;
+            w.strings = (char*) (w.entry + w.count);
+            w.count   = 0;
+            w.chars   = 0;
+            rc = exportPass( &w, path, prefix.str, prefix.len);
         }
+    }
  
-        memcpy( node->value, parms->str_wrk, parms->str_len);
+    parmFmem( prefix.str );
  
-        // Are we at end of this level?
-        if( term_char == '}' )
-            return +1;
+    if( rc < 0 ) {
+        parmFmem( table );
+        return rc;
     }
  
-    return 0;
+    *out = table;
+    return table->count;
 }
  
  
 //----------------------------------------------------------------------
-// Parse out a node...
+// parmFreeExport() -- Free a table from parmExport()...
 //----------------------------------------------------------------------
-static int parmParseNode( PARSE_BLOCK* parms, PRMP_ANCHOR* anchor)
+void parmFreeExport( PRMP_EXPORT* out)
 {
-    PRMP_NODE* node;
-    int rc;
+    parmFmem( out );
+}
  
-    parms->current_anchor = anchor;
  
-    while( 1 ) {
-
-        // now, get a node...
-        if( (node = parmGtms( &parms->gtms, sizeof(PRMP_NODE), "PNOD")) == NULL ) {
-            return -3;           // Out of memory!
-        }
+//----------------------------------------------------------------------
+// Sharing parsed parameters between processes. A generation of the
+// parameters is published as a POSIX shared memory segment "/name.gen"
+// holding a header and a copy of the arena. Since nodes only refer to
+// each other by offset, the copy works wherever it is mapped. Values
+// are decoded and every level's index is built before the copy is made,
+// so attached processes never write to it. A small control segment
+// "/name" holds the generation currently published...
+//----------------------------------------------------------------------
+#define PRMP_SHM_MAGIC     0x504d5250    // "PRMP"
+#define PRMP_SHM_NAME_LEN  256
  
-        if( (rc = parse_key(parms, node)) < 0 ) {
-            return rc;
-        }
+typedef struct _shm_header {
+    uint32_t magic;
+    uint32_t generation;
+    uint64_t size;                       // Size of the whole segment.
+    uint32_t top_anchor;                 // Arena offset of the top anchor.
+    uint32_t used;                       // Size of the arena copy.
+} PRMP_SHM_HEADER;
  
-        if ( parms->is_eof )      // End of input, then just return.
-            return 0;
+typedef struct _shm_control {
+    uint32_t magic;
+    uint32_t generation;                 // Currently published, 0 = none.
+    uint32_t claimed;                    // Last generation number handed to a publisher.
+} PRMP_SHM_CONTROL;
  
-        if( (rc = parse_value(parms, node)) < 0 ) {
-            return rc;
-        }
-
-        if ( parms->is_eof )      // End of input at this point is a syntax error.
-            return -2;
+#define PRMP_SHM_HDR_SIZE    ((sizeof(PRMP_SHM_HEADER) + 7) & ~7)
+#define PRMP_SHM_ARENA(hdr)  ((char*) (hdr) + PRMP_SHM_HDR_SIZE)
  
-        // Alright, now we have a complete node.  Add to chain off anchor...
-        if( anchor->first == NULL ) {
-            anchor->first = node;
-            anchor->last  = node;
-        } else {
-            anchor->last->next = node;
-            anchor->last       = node;
-        }
  
-        if( rc > 0 )          // If we received }, then break.  *REFACTOR*
-            break;
+//----------------------------------------------------------------------
+// Work out how much a level adds to the arena copy: decoded values that
+// differ from the raw ones, and the level's index...
+//----------------------------------------------------------------------
+static int sharedSize( PRMP_HANDLE* prmp, PRMP_ANCHOR* anchor, uint64_t* size)
+{
+    PRMP_NODE* node;
+    uint64_t   n = 0;
+    char*      value;
+    int        rc;
+ 
+    for( node = HNODE(prmp, anchor->first); node != NULL; node = HNODE(prmp, PRMP_NODE_NEXT(node)) ) {
+        n++;
+        if( PRMP_NODE_TYPE(node) == PRMP_NEXTLEVEL ) {
+            if( (rc = sharedSize( prmp, HANCHOR(prmp, node->value.ool.off), size)) < 0 )
+                return rc;
+        } else if( (node->value.ool.tag & PRMP_SLOT_OOL) &&
+                   (node->value.ool.tag & ~PRMP_SLOT_OOL) ) {
+            if( (rc = resolveValue( prmp, node, &value)) == -5 )
+                value = "";      // Reference cycle. Published empty.
+            else if( rc < 0 )
+                return rc;
+            *size += strlen( value ) + 1;
+        }
     }
  
-    parms->current_anchor = anchor->up;
+    *size += (n + 1) * sizeof(uint32_t) + sizeof(uint32_t);   // Index, aligned.
  
+    return 0;
 }
  
  
- 
 //----------------------------------------------------------------------
-// Top level parsing...
+// Fill in a level of the arena copy: put decoded values after the arena
+// and build the level's index there too. Offsets are the same in the
+// copy as in the handle, so we read one and write the other. A value in
+// a reference cycle goes in as "" marked PRMP_SLOT_CYCLE, so it still
+// gets -5 in the attached processes...
 //----------------------------------------------------------------------
-static int parmParse(void** handle, PARSE_BLOCK* parms)
+static int sharedFill( PRMP_HANDLE* prmp, char* base, uint32_t anchor, uint32_t* used)
 {
-    int   rc;
-    PRMP_HANDLE* prmp_handle;
+    PRMP_ANCHOR* copy = (PRMP_ANCHOR*) (base + anchor);
+    PRMP_NODE*   node;
+    uint32_t*    index;
+    uint32_t*    work;
+    uint32_t     off;
+    uint32_t     n = 0;
+    char*        value;
+    int          rc;
+ 
+    for( off = copy->first; off != 0; off = PRMP_NODE_NEXT(node) ) {
+        node = (PRMP_NODE*) (base + off);
+        n++;
+        if( PRMP_NODE_TYPE(node) == PRMP_NEXTLEVEL ) {
+            if( (rc = sharedFill( prmp, base, node->value.ool.off, used)) < 0 )
+                return rc;
+        } else if( (node->value.ool.tag & PRMP_SLOT_OOL) &&
+                   (node->value.ool.tag & ~PRMP_SLOT_OOL) ) {
+            if( (rc = resolveValue( prmp, (PRMP_NODE*) (prmp->base + off), &value)) == -5 ) {
+                value = "";      // Reference cycle. Published empty, still -5.
+                node->value.ool.tag = PRMP_SLOT_OOL | PRMP_SLOT_CYCLE;
+            } else if( rc < 0 ) {
+                return rc;
+            } else {
+                node->value.ool.tag = PRMP_SLOT_OOL;
+            }
+            strcpy( base + *used, value);
+            node->value.ool.off = *used;
+            *used += (uint32_t) strlen( value ) + 1;
+        }
+    }
  
+    if( (work = parmGmem( (n + 1) * sizeof(uint32_t), "PIDW")) == NULL )
+        return -3;               // Out of memory!
  
-    if( (rc = parmParseNode( parms, parms->top_anchor )) < 0) {
-        return rc;           // Some error during parsing!
-    }
+    *used = (*used + 3) & ~3u;
+    index = (uint32_t*) (base + *used);
+    index[0] = n;
+    n = 0;
+    for( off = copy->first; off != 0; off = PRMP_NODE_NEXT((PRMP_NODE*) (base + off)) )
+        index[++n] = off;
  
-    if( (prmp_handle = parmGtms( &parms->gtms, sizeof(PRMP_HANDLE), "PHND")) == NULL ) {
-        return -3;           // Out of memory!
-    }
+    sortByKey( base, index + 1, work, n);
+    parmFmem( work );
  
-    prmp_handle->anchor = parms->top_anchor;
-    prmp_handle->gtms   = parms->gtms;
-    *handle             = (void*) prmp_handle;
+    copy->index = *used;
+    *used += (n + 1) * sizeof(uint32_t);
  
     return 0;
 }
  
  
 //----------------------------------------------------------------------
-// Parse out parameter file and return handle and results. If memname
-// is NULL, then input dataset is not a PDS, but a sequencial file.
+// Open (and maybe create) the control segment for name...
 //----------------------------------------------------------------------
-int parmParseFile(void** handle, char* filename)
+static PRMP_SHM_CONTROL* sharedControl( char* name, BOOL create)
 {
-    int   rc = 0;
-    PARSE_BLOCK* parms;
- 
- 
-    if( (parms = initParseBlock()) == NULL) {
-        rc = -16;
-    } else {
-
-        parms->fs = fopen ( filename, "r");
+    PRMP_SHM_CONTROL* ctl;
+    char  shm_name[PRMP_SHM_NAME_LEN];
+    int   fd;
  
-        if( parms->fs == NULL) {
-            fprintf(stderr, "Could not open configuration file %s\n", filename);
-            return -4;
-        } else {
+    if( snprintf( shm_name, sizeof(shm_name), "/%s", name) >= (int) sizeof(shm_name) )
+        return NULL;
  
-            parms->linenbr = 0;
-
-            rc = parmParse(handle, parms );
-        }
+    // Only the publisher writes to it; readers may only be allowed to read...
+    if( (fd = shm_open( shm_name, create ? O_RDWR | O_CREAT : O_RDONLY, 0644)) < 0 )
+        return NULL;
  
-        freeParseBlock( parms );
+    if( create && ftruncate( fd, sizeof(PRMP_SHM_CONTROL)) < 0 ) {
+        close( fd );
+        return NULL;
     }
  
-    //if (rc < 0 && parms->gtms != NULL) {
-    //    freetms( &parms->gtms );
-    //}
- 
-    return rc;
-}
- 
- 
-//----------------------------------------------------------------------
-// parmSetBegin() -- Prepare for traversing the parameters. Just
-//                       reset pointers in handle.
-//----------------------------------------------------------------------
-int parmSetBegin(    void* handle)
-{
-    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+    ctl = mmap( NULL, sizeof(PRMP_SHM_CONTROL), create ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_SHARED, fd, 0);
+    close( fd );
  
-    prmp->cur_anchor       = NULL;
-    prmp->cur_node         = NULL;
-    prmp->node_stack_index = 0;
+    return (ctl == MAP_FAILED) ? NULL : ctl;
 }
  
  
 //----------------------------------------------------------------------
-// parmGetNext() --
+// parmPublishShared() -- Publish a new generation of the parameters in
+//                        handle under name and return its number...
 //----------------------------------------------------------------------
-int parmGetNext(     void* handle, char** key, char** value)
+int parmPublishShared( void* handle, char* name)
 {
-    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
- 
-    if( prmp->cur_anchor == NULL ) {
-        prmp->cur_anchor = prmp->anchor;
-        prmp->cur_node   = NULL;
-    }
- 
-    if( prmp->cur_node   == NULL ) {
-        if( (prmp->cur_node = prmp->cur_anchor->first) == NULL)
-            return PRMP_END;
-    } else {
-        if( (prmp->cur_node = prmp->cur_node->next) == NULL)
-            return PRMP_END;
+    PRMP_HANDLE*      prmp = (PRMP_HANDLE*) handle;
+    PRMP_SHM_CONTROL* ctl;
+    PRMP_SHM_HEADER*  hdr;
+    char      shm_name[PRMP_SHM_NAME_LEN];
+    uint64_t  size = 0;
+    uint32_t  generation;
+    uint32_t  current;
+    uint32_t  claimed;
+    uint32_t  used;
+    char*     base;
+    int       fd;
+    int       rc;
+ 
+    if( (rc = sharedSize( prmp, prmp->anchor, &size)) < 0 )
+        return rc;
+ 
+    size += prmp->used;
+    if( size > UINT32_MAX )
+        return -3;               // Offsets no longer fit in 32 bits.
+    size += PRMP_SHM_HDR_SIZE;
+ 
+    if( (ctl = sharedControl( name, TRUE )) == NULL )
+        return -4;
+    ctl->magic = PRMP_SHM_MAGIC;
+ 
+    // Claim a generation number of our own, so publishers running at the
+    // same time never fill (or remove) each other's segments...
+    claimed = __atomic_load_n( &ctl->claimed, __ATOMIC_ACQUIRE);
+    do {
+        current    = __atomic_load_n( &ctl->generation, __ATOMIC_ACQUIRE);
+        generation = (claimed > current ? claimed : current) + 1;
+    } while( !__atomic_compare_exchange_n( &ctl->claimed, &claimed, generation, FALSE,
+                                           __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) );
+ 
+    snprintf( shm_name, sizeof(shm_name), "/%s.%u", name, generation);
+    shm_unlink( shm_name );              // Left over from a removed control segment?
+    if( (fd = shm_open( shm_name, O_RDWR | O_CREAT | O_EXCL, 0644)) < 0 ) {
+        munmap( ctl, sizeof(PRMP_SHM_CONTROL) );
+        return -4;
     }
  
-    *key = prmp->cur_node->key;
-    if( prmp->cur_node->type == PRMP_STRING ) {
-        *value = prmp->cur_node->value;
-        return PRMP_STRING;
-    } else {
-        return (int) prmp->cur_node->type;
+    if( ftruncate( fd, (off_t) size) < 0 ||
+        (hdr = mmap( NULL, (size_t) size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED ) {
+        close( fd );
+        shm_unlink( shm_name );
+        munmap( ctl, sizeof(PRMP_SHM_CONTROL) );
+        return -4;
     }
-}
+    close( fd );
  
+    base = PRMP_SHM_ARENA(hdr);
+    memcpy( base, prmp->base, prmp->used);
+    used = prmp->used;
  
-//----------------------------------------------------------------------
-// parmLevelDown() -- Go down a level. We can only go down a level
-//                        if the current node has a next level, other-
-//                        wise, a -1 is returned. So that we can later
-//                        get back to the node we were on, we keep a
-//                        stack of pointers to nodes...
-//----------------------------------------------------------------------
-int parmLevelDown(   void* handle )
-{
-    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+    if( (rc = sharedFill( prmp, base, (uint32_t) ((char*) prmp->anchor - prmp->base), &used)) < 0 ) {
+        munmap( hdr, (size_t) size );
+        shm_unlink( shm_name );
+        munmap( ctl, sizeof(PRMP_SHM_CONTROL) );
+        return rc;
+    }
  
-    if( prmp->cur_node != NULL && prmp->cur_node->type == PRMP_NEXTLEVEL &&
-        prmp->node_stack_index < PRMP_MAX_LEVELS ) {
-        prmp->cur_anchor = prmp->cur_node->nextlevel;
-        prmp->node_stack[prmp->node_stack_index++] = prmp->cur_node;
-        prmp->cur_node   = NULL;
-        return 0;
+    hdr->generation = generation;
+    hdr->size       = size;
+    hdr->top_anchor = (uint32_t) ((char*) prmp->anchor - prmp->base);
+    hdr->used       = used;
+    hdr->magic      = PRMP_SHM_MAGIC;
+    munmap( hdr, (size_t) size );
+ 
+    // Switch everyone over to the new generation and drop the one it
+    // replaces. Processes still attached to that keep their mapping. If a
+    // publisher that claimed a later number got there first, ours is
+    // already out of date, so it is the one dropped...
+    current = __atomic_load_n( &ctl->generation, __ATOMIC_ACQUIRE);
+    while( current < generation &&
+           !__atomic_compare_exchange_n( &ctl->generation, &current, generation, FALSE,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) );
+    munmap( ctl, sizeof(PRMP_SHM_CONTROL) );
+ 
+    if( current > generation )
+        current = generation;            // Superseded. Drop ours.
+    if( current > 0 ) {
+        snprintf( shm_name, sizeof(shm_name), "/%s.%u", name, current);
+        shm_unlink( shm_name );
     }
  
-    return -1;
+    return (int) generation;
 }
  
  
 //----------------------------------------------------------------------
-// parmLevelUp() -- Go up a level...
+// parmSharedGeneration() -- Return the generation published under name,
+//                           0 if there is none...
 //----------------------------------------------------------------------
-int parmLevelUp(     void* handle )
+int parmSharedGeneration( char* name)
 {
-    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
+    PRMP_SHM_CONTROL* ctl;
+    uint32_t generation;
  
-    if( prmp->cur_anchor->up != NULL && prmp->node_stack_index > 0 ) {
-        prmp->cur_anchor = prmp->cur_anchor->up;
-        prmp->cur_node   = prmp->node_stack[--prmp->node_stack_index];
+    if( (ctl = sharedControl( name, FALSE )) == NULL )
         return 0;
-    }
  
-    return -1;
+    generation = __atomic_load_n( &ctl->generation, __ATOMIC_ACQUIRE);
+    munmap( ctl, sizeof(PRMP_SHM_CONTROL) );
+ 
+    return (int) generation;
 }
  
  
 //----------------------------------------------------------------------
-// parmFindKey() -- Find first key within a level...
+// parmAttachShared() -- Map the generation currently published under
+//                       name read-only and return a handle for it and
+//                       the generation's number. Free the handle with
+//                       parmFree()...
 //----------------------------------------------------------------------
-int parmFindKey( void* handle, char* key, char** value)
+int parmAttachShared( void** handle, char* name)
 {
-    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
- 
-    // If we haven't done a search yet, then start at the top level...
-    if( prmp->cur_anchor == NULL ) {
-        prmp->cur_anchor = prmp->anchor;
-        prmp->cur_node   = NULL;
+    PRMP_HANDLE*     prmp;
+    PRMP_SHM_HEADER* hdr;
+    struct stat st;
+    char  shm_name[PRMP_SHM_NAME_LEN];
+    int   generation;
+    int   tries;
+    int   fd = -1;
+ 
+    // The generation can be replaced between reading its number and
+    // opening it, so try again with the newer one...
+    for( tries = 0; tries < 3 && fd < 0; tries++ ) {
+        if( (generation = parmSharedGeneration( name )) == 0 )
+            return -4;           // Nothing published.
+        snprintf( shm_name, sizeof(shm_name), "/%s.%u", name, (uint32_t) generation);
+        fd = shm_open( shm_name, O_RDONLY, 0);
     }
+    if( fd < 0 )
+        return -4;
  
-    // First node to check within this level...
-    prmp->cur_node = prmp->cur_anchor->first;
+    if( fstat( fd, &st) < 0 || st.st_size < (off_t) sizeof(PRMP_SHM_HEADER) ||
+        (hdr = mmap( NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED ) {
+        close( fd );
+        return -4;
+    }
+    close( fd );
  
-    // Go through the nodes at this level and find first that matches...
-    while( prmp->cur_node != NULL ) {
+    if( hdr->magic != PRMP_SHM_MAGIC || hdr->size != (uint64_t) st.st_size ) {
+        munmap( hdr, (size_t) st.st_size );
+        return -4;
+    }
  
-        if( strcmp(prmp->cur_node->key, key) == 0 ) {
-            if( prmp->cur_node->type == PRMP_STRING ) {
-                *value = prmp->cur_node->value;
-                return PRMP_STRING;
-            } else {
-                return (int) prmp->cur_node->type;
-            }
-        }
-        prmp->cur_node = prmp->cur_node->next;
+    if( (prmp = parmGmem( sizeof(PRMP_HANDLE), "PHND")) == NULL ) {
+        munmap( hdr, (size_t) st.st_size );
+        return -3;               // Out of memory!
     }
  
-    return PRMP_END;
+    prmp->shm_base = (char*) hdr;
+    prmp->shm_size = (size_t) st.st_size;
+    prmp->base     = PRMP_SHM_ARENA(hdr);
+    prmp->used     = hdr->used;
+    prmp->anchor   = (PRMP_ANCHOR*) (prmp->base + hdr->top_anchor);
+    *handle        = (void*) prmp;
+ 
+    return generation;
 }
  
  
 //----------------------------------------------------------------------
-// parmFindNextKey() -- Find next key within a level...
+// parmRemoveShared() -- Remove the parameters published under name.
+//                       Processes still attached keep their mapping...
 //----------------------------------------------------------------------
-int parmFindNextKey( void* handle, char* key, char** value)
+int parmRemoveShared( char* name)
 {
-    PRMP_HANDLE* prmp = (PRMP_HANDLE*) handle;
- 
-    // If we haven't done a search yet, then start at the top level...
-    if( prmp->cur_anchor == NULL ) {
-        prmp->cur_anchor = prmp->anchor;
-        prmp->cur_node   = NULL;
-    }
+    char shm_name[PRMP_SHM_NAME_LEN];
+    int  generation;
  
-    // Next node to check. Its possible we are to start from the beginning...
-    if( prmp->cur_node   == NULL ) {
-        prmp->cur_node = prmp->cur_anchor->first;
-    } else {
-        prmp->cur_node = prmp->cur_node->next;
+    if( (generation = parmSharedGeneration( name )) > 0 ) {
+        snprintf( shm_name, sizeof(shm_name), "/%s.%u", name, (uint32_t) generation);
+        shm_unlink( shm_name );
     }
  
-    // Go through rest of nodes at this level that matches...
-    while( prmp->cur_node != NULL ) {
-        if( strcmp(prmp->cur_node->key, key) == 0 ) {
-            if( prmp->cur_node->type == PRMP_STRING ) {
-                *value = prmp->cur_node->value;
-                return PRMP_STRING;
-            } else {
-                return (int) prmp->cur_node->type;
-            }
-        }
-        prmp->cur_node = prmp->cur_node->next;
-    }
+    if( snprintf( shm_name, sizeof(shm_name), "/%s", name) >= (int) sizeof(shm_name) )
+        return -1;
  
-    return PRMP_END;
-}
+    return shm_unlink( shm_name ) == 0 ? 0 : -4;
+}
\ No newline at end of file
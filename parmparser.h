@@ -39,11 +39,89 @@
 // PARMPRSR parameter file parsing...
 //--------------------------------------------------------------------
  
+#include <stdio.h>
+ 
+#ifdef __cplusplus
+extern "C" {
+#endif
+ 
 #define PRMP_END        0
 #define PRMP_STRING     1
 #define PRMP_NEXTLEVEL  2
  
+//--------------------------------------------------------------------
+// Input source.  read() fills buf with up to len bytes and returns the
+// number of bytes read, 0 at end of input, or negative on error. close()
+// releases whatever the source set up (it may be NULL)...
+//--------------------------------------------------------------------
+typedef struct _prmp_reader {
+    void*  ctx;
+    int  (*read)( void* ctx, char* buf, int len);
+    void (*close)(void* ctx);
+} PRMP_READER;
+ 
+//--------------------------------------------------------------------
+// Iterator over keys found by parmFindPrefix() and parmFindRange()...
+//--------------------------------------------------------------------
+typedef struct _prmp_iter {
+    void*       handle;
+    const void* next;
+    const void* end;
+} PRMP_ITER;
+ 
+//--------------------------------------------------------------------
+// Where and why a parse failed, from parmGetError()...
+//--------------------------------------------------------------------
+typedef struct _prmp_error {
+    int         code;             // -2 syntax error, -3 out of memory, -4 read error.
+    int         line;             // Line number, starting at 1.
+    int         column;           // Column within the line, starting at 1.
+    long        offset;           // Byte offset from start of input.
+    const char* expected;         // What the parser was looking for (or NULL).
+} PRMP_ERROR;
+ 
+//--------------------------------------------------------------------
+// Flat, depth-first table of key/value pairs from parmExport(). It is
+// one block of memory, entries and paths included...
+//--------------------------------------------------------------------
+#define PRMP_EXPORT_NOPATH  0x01         // Don't build the dotted paths.
+ 
+typedef struct _prmp_export_entry {
+    char*  path;                  // Dotted path from the top (NULL with PRMP_EXPORT_NOPATH).
+    char*  key;
+    char*  value;                 // NULL for a level.
+    int    type;                  // PRMP_STRING or PRMP_NEXTLEVEL.
+    int    depth;                 // 0 for the entries the export starts with.
+    int    parent;                // Index of the level this is in, or -1 at depth 0.
+} PRMP_EXPORT_ENTRY;
+ 
+typedef struct _prmp_export {
+    int                 count;    // Number of entries.
+    PRMP_EXPORT_ENTRY*  entries;
+} PRMP_EXPORT;
+ 
 int parmParseFile(void** handle, char* filename);
+int parmParseSource(void** handle, PRMP_READER* reader);
+ 
+int parmContextCreate(  void** ctx);
+int parmParseFileWith(  void* ctx, void** handle, char* filename);
+int parmParseSourceWith(void* ctx, void** handle, PRMP_READER* reader);
+int parmContextDestroy( void* ctx);
+int parmFree(           void* handle);
+ 
+int parmParserCreate(   void** parser);
+int parmFeed(           void* parser, const char* buf, int len);
+int parmFinish(         void* parser, void** handle);
+int parmParserDestroy(  void* parser);
+ 
+int parmSetRecovery(    void* ctx, int max_errors);
+int parmGetError(       void* ctx, int n, PRMP_ERROR* error);
+ 
+int parmReaderFd(       PRMP_READER* reader, int fd);
+int parmReaderStream(   PRMP_READER* reader, FILE* fs);
+int parmReaderMemory(   PRMP_READER* reader, const char* buf, int len);
+int parmReaderReadAhead(PRMP_READER* reader, PRMP_READER* source);
+void parmReaderClose(   PRMP_READER* reader);
  
 int parmSetBegin(    void* handle);
 int parmGetNext(     void* handle, char** key, char** value);
@@ -53,6 +131,22 @@ int parmLevelUp(     void* handle );
 int parmFindKey(     void* handle, char* key, char** value);
 int parmFindNextKey( void* handle, char* key, char** value);
  
+int parmPublishShared(    void* handle, char* name);
+int parmAttachShared(     void** handle, char* name);
+int parmSharedGeneration( char* name);
+int parmRemoveShared(     char* name);
+ 
+int parmFindPrefix(  void* handle, char* prefix, PRMP_ITER* iter);
+int parmFindRange(   void* handle, char* lo, char* hi, PRMP_ITER* iter);
+int parmIterNext(    PRMP_ITER* iter, char** key, char** value);
+ 
+int parmExport(      void* handle, char* path, int flags, PRMP_EXPORT** out);
+void parmFreeExport( PRMP_EXPORT* out);
+ 
+#ifdef __cplusplus
+}
+#endif
+ 
  
 #endif // PARMPRSR_H_
  
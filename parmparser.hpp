@@ -0,0 +1,249 @@
+//----------------------------------------------------------------------
+//                         parm parser
+//
+// C++ API. A parm::Document owns a parsed handle. Its levels are ranges
+// of entries that can be used with range-for and <algorithm>, and keys
+// and values come back as std::string_view pointing into the parsed
+// parameters, so nothing is copied. Everything walks the nodes directly
+// (see parmnode.h) and does not use or disturb the handle's cursor.
+// Nothing allocates, except that the first value() of a value with
+// escapes or ${} references has the C library decode it into memory it
+// allocates (and keeps) for the handle.
+//
+//   parm::Document doc;
+//   if( doc.parseFile("testprms.ini") == 0 ) {
+//       for( auto& dl : doc.root().equal_range("download") )
+//           std::cout << dl.level().find("from")->value() << "\n";
+//   }
+//
+//----------------------------------------------------------------------
+#ifndef PARMPRSR_HPP_
+#define PARMPRSR_HPP_
+
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+#include <utility>
+
+#include "parmparser.h"
+#include "parmnode.h"
+
+namespace parm {
+
+class Level;
+
+
+//--------------------------------------------------------------------
+// A key/value pair. The value is either a string or another Level...
+//--------------------------------------------------------------------
+class Entry {
+public:
+    Entry() noexcept = default;
+    Entry(void* handle, char* base, PRMP_NODE* node) noexcept
+        : handle_(handle), base_(base), node_(node) {}
+
+    int  type()    const noexcept { return PRMP_NODE_TYPE(node_); }
+    bool isLevel() const noexcept { return type() == PRMP_NEXTLEVEL; }
+
+    std::string_view key() const noexcept { return slot(&node_->key); }
+
+    // Empty for levels. Values with escapes or ${} references are decoded
+    // by the C library the first time, which allocates; if that fails,
+    // the value is empty too...
+    std::string_view value() const noexcept {
+        char* value;
+        if( isLevel() )
+            return std::string_view();
+        if( (node_->value.ool.tag & PRMP_SLOT_OOL) && (node_->value.ool.tag & PRMP_SLOT_LAZY) )
+            return parmNodeValue(handle_, node_, &value) == 0 ? std::string_view(value)
+                                                                : std::string_view();
+        return slot(&node_->value);
+    }
+
+    inline Level level() const noexcept;
+
+    PRMP_NODE* node() const noexcept { return node_; }
+
+private:
+    std::string_view slot(PRMP_SLOT* slot) const noexcept {
+        return (slot->ool.tag & PRMP_SLOT_OOL) ? std::string_view(base_ + slot->ool.off)
+                                               : std::string_view(slot->inl);
+    }
+
+    void*      handle_ = nullptr;
+    char*      base_   = nullptr;
+    PRMP_NODE* node_   = nullptr;
+};
+
+
+//--------------------------------------------------------------------
+// The entries of one level, in file order. Iterators can be limited to
+// entries with one key, which is how find() and equal_range() deal with
+// duplicate keys...
+//--------------------------------------------------------------------
+class Level {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type        = Entry;
+        using difference_type   = std::ptrdiff_t;
+        using pointer           = const Entry*;
+        using reference         = const Entry&;
+
+        iterator() noexcept = default;
+        iterator(void* handle, char* base, uint32_t off, std::string_view key,
+                 bool by_key) noexcept
+            : handle_(handle), base_(base), key_(key), by_key_(by_key) { seek(off); }
+
+        reference operator*()  const noexcept { return entry_; }
+        pointer   operator->() const noexcept { return &entry_; }
+
+        iterator& operator++() noexcept { seek(PRMP_NODE_NEXT(entry_.node())); return *this; }
+        iterator  operator++(int) noexcept { iterator it = *this; ++*this; return it; }
+
+        friend bool operator==(const iterator& a, const iterator& b) noexcept {
+            return a.entry_.node() == b.entry_.node();
+        }
+        friend bool operator!=(const iterator& a, const iterator& b) noexcept {
+            return !(a == b);
+        }
+
+    private:
+        // Step to the node at off, or the first one after it with our key...
+        void seek(uint32_t off) noexcept {
+            PRMP_NODE* node = nullptr;
+            for( ; off != 0; off = PRMP_NODE_NEXT(node) ) {
+                node = reinterpret_cast<PRMP_NODE*>(base_ + off);
+                if( !by_key_ || Entry(handle_, base_, node).key() == key_ )
+                    break;
+            }
+            entry_ = Entry(handle_, base_, off ? node : nullptr);
+        }
+
+        void*            handle_ = nullptr;
+        char*            base_   = nullptr;
+        Entry            entry_;
+        std::string_view key_;
+        bool             by_key_ = false;
+    };
+
+    struct Range : std::pair<iterator, iterator> {
+        using std::pair<iterator, iterator>::pair;
+        iterator begin() const noexcept { return first; }
+        iterator end()   const noexcept { return second; }
+    };
+
+    Level() noexcept = default;
+    Level(void* handle, char* base, PRMP_ANCHOR* anchor) noexcept
+        : handle_(handle), base_(base), anchor_(anchor) {}
+
+    iterator begin() const noexcept { return iterator(handle_, base_, first(), {}, false); }
+    iterator end()   const noexcept { return iterator(); }
+    bool     empty() const noexcept { return first() == 0; }
+
+    // First entry with key, or end()...
+    iterator find(std::string_view key) const noexcept {
+        iterator it(handle_, base_, first(), key, true);
+        return iterator(handle_, base_, it == end() ? 0 : offset(it), {}, false);
+    }
+
+    // All entries with key, in file order...
+    Range equal_range(std::string_view key) const noexcept {
+        return Range(iterator(handle_, base_, first(), key, true), end());
+    }
+
+private:
+    uint32_t first() const noexcept { return anchor_ ? anchor_->first : 0; }
+    uint32_t offset(const iterator& it) const noexcept {
+        return static_cast<uint32_t>(reinterpret_cast<char*>(it->node()) - base_);
+    }
+
+    void*        handle_ = nullptr;
+    char*        base_   = nullptr;
+    PRMP_ANCHOR* anchor_ = nullptr;
+};
+
+
+// Next level of a PRMP_NEXTLEVEL entry, an empty Level otherwise...
+inline Level Entry::level() const noexcept {
+    if( !isLevel() )
+        return Level();
+    return Level(handle_, base_, reinterpret_cast<PRMP_ANCHOR*>(base_ + node_->value.ool.off));
+}
+
+
+//--------------------------------------------------------------------
+// Owns a handle from parmParseFile(), parmParseSource() or
+// parmAttachShared() and frees it with parmFree(). Move-only...
+//--------------------------------------------------------------------
+class Document {
+public:
+    Document() noexcept = default;
+    explicit Document(void* handle) noexcept { adopt(handle); }
+    ~Document() { parmFree(handle_); }
+
+    Document(const Document&)            = delete;
+    Document& operator=(const Document&) = delete;
+
+    Document(Document&& other) noexcept
+        : handle_(std::exchange(other.handle_, nullptr)),
+          base_(std::exchange(other.base_, nullptr)),
+          anchor_(std::exchange(other.anchor_, nullptr)) {}
+
+    Document& operator=(Document&& other) noexcept {
+        if( this != &other ) {
+            parmFree(handle_);
+            handle_ = std::exchange(other.handle_, nullptr);
+            base_   = std::exchange(other.base_, nullptr);
+            anchor_ = std::exchange(other.anchor_, nullptr);
+        }
+        return *this;
+    }
+
+    // These return the C API's codes; on failure the document is empty...
+    int parseFile(const char* filename) noexcept {
+        void* handle = nullptr;
+        int   rc = parmParseFile(&handle, const_cast<char*>(filename));
+        adopt(rc == 0 ? handle : nullptr);
+        return rc;
+    }
+
+    int parse(PRMP_READER& reader) noexcept {
+        void* handle = nullptr;
+        int   rc = parmParseSource(&handle, &reader);
+        adopt(rc == 0 ? handle : nullptr);
+        return rc;
+    }
+
+    int attachShared(const char* name) noexcept {
+        void* handle = nullptr;
+        int   rc = parmAttachShared(&handle, const_cast<char*>(name));
+        adopt(rc > 0 ? handle : nullptr);
+        return rc;
+    }
+
+    Level root()   const noexcept { return Level(handle_, base_, anchor_); }
+    void* handle() const noexcept { return handle_; }
+
+    explicit operator bool() const noexcept { return handle_ != nullptr; }
+
+private:
+    void adopt(void* handle) noexcept {
+        parmFree(handle_);
+        handle_ = handle;
+        base_   = nullptr;
+        anchor_ = nullptr;
+        if( handle_ != nullptr )
+            parmRoot(handle_, &base_, &anchor_);
+    }
+
+    void*        handle_ = nullptr;
+    char*        base_   = nullptr;
+    PRMP_ANCHOR* anchor_ = nullptr;
+};
+
+} // namespace parm
+
+#endif // PARMPRSR_HPP_
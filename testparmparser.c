@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <unistd.h>
  
 #include "parmparser.h"     // Parameter Parsing routines.
  
@@ -76,6 +77,361 @@ void printNodes(void* handle)
 }
  
  
+//-----------------------------------------------------------------------------
+// Parse the same kind of parameters out of memory, read ahead on a thread...
+//-----------------------------------------------------------------------------
+void testMemorySource(void)
+{
+    static char parms[] =
+        "# Parameters from memory\n"
+        "host: localhost\r\n"
+        "limits: {\n"
+        "   max: 10\n"
+        "}\n"
+        "last: 'no newline'";
+    PRMP_READER mem;
+    PRMP_READER reader;
+    void* handle;
+    int   rc;
+ 
+    parmReaderMemory( &mem, parms, sizeof(parms) - 1 );
+    parmReaderReadAhead( &reader, &mem );
+ 
+    rc = parmParseSource( &handle, &reader );
+    parmReaderClose( &reader );
+ 
+    printf("rc from parmParseSource: %d\n", rc);
+    if( rc == 0 ) {
+        parmSetBegin( handle);
+        printNodes( handle );
+        parmFree( handle );
+    }
+}
+ 
+ 
+//-----------------------------------------------------------------------------
+// Parse the same file a few times with one parse context...
+//-----------------------------------------------------------------------------
+void testContext(void)
+{
+    PRMP_ITER iter;
+    void* ctx;
+    void* handle;
+    char* value;
+    int   rc;
+    int   i;
+ 
+    parmContextCreate( &ctx );
+ 
+    for( i = 0; i < 3; i++ ) {
+        rc = parmParseFileWith( ctx, &handle, "testprms.ini" );
+        printf("rc from parmParseFileWith: %d\n", rc);
+        if( rc == 0 && parmFindKey( handle, "email", &value) == PRMP_STRING )
+            printf("pass %d email: %s\n", i, value);
+        if( rc == 0 )
+            printf("pass %d downloads: %d\n", i, parmFindPrefix( handle, "down", &iter));
+    }
+ 
+    parmContextDestroy( ctx );
+}
+ 
+ 
+//-----------------------------------------------------------------------------
+// Escapes and ${} references get decoded when values are asked for...
+//-----------------------------------------------------------------------------
+void testDecoding(void)
+{
+    static char parms[] =
+        "server: {\n"
+        "   host: example.com\n"
+        "   port: 8080\n"
+        "}\n"
+        "url: \"http://${server.host}:${server.port}/\\x41\\tpath\"\n"
+        "user: ${PARM_TEST_USER}\n"
+        "quoted: \"say \\\"hi\\\" \\${not.a.ref}\"\n"
+        "literal: '${server.host}\\n'\n"
+        "loop1: ${loop2}\n"
+        "loop2: ${loop1}\n"
+        "\"a\\\"b\": 'escaped key'\n"
+        "nul: \"a\\x00b\"\n"
+        "route.eu: r1\n"
+        "srv: { host.name: h }\n"
+        "dotted: \"${route.eu} ${srv.host.name}\"\n";
+    static char* keys[] = { "url", "user", "quoted", "literal", "loop1", "a\"b", "nul", "dotted" };
+    PRMP_READER reader;
+    void* handle;
+    char* value;
+    int   type;
+    int   i;
+ 
+    setenv( "PARM_TEST_USER", "joverton", 1 );
+ 
+    parmReaderMemory( &reader, parms, sizeof(parms) - 1 );
+    printf("rc from parmParseSource: %d\n", parmParseSource( &handle, &reader ));
+    parmReaderClose( &reader );
+ 
+    for( i = 0; i < (int) (sizeof(keys) / sizeof(keys[0])); i++ ) {
+        value = NULL;
+        type  = parmFindKey( handle, keys[i], &value);
+        printf("%s. Type: %d Value: [%s]\n", keys[i], type, type == PRMP_STRING ? value : "");
+    }
+ 
+    parmFree( handle );
+}
+ 
+ 
+//-----------------------------------------------------------------------------
+// Find keys by prefix and by range...
+//-----------------------------------------------------------------------------
+void testPrefixRange(void)
+{
+    static char parms[] =
+        "route.us-east.7: a\n"
+        "route.eu-west.2: b\n"
+        "zone: z\n"
+        "route.eu-west.10: c\n"
+        "route.eu-west.2: d\n"
+        "route.eu: { near: yes }\n";
+    PRMP_READER reader;
+    PRMP_ITER iter;
+    void* handle;
+    char* key;
+    char* value;
+    int   type;
+ 
+    parmReaderMemory( &reader, parms, sizeof(parms) - 1 );
+    type = parmParseSource( &handle, &reader );
+    parmReaderClose( &reader );
+    if( type != 0 )
+        return;
+ 
+    printf("prefix route.eu-west. count: %d\n", parmFindPrefix( handle, "route.eu-west.", &iter));
+    while( (type = parmIterNext( &iter, &key, &value)) == PRMP_STRING )
+        printf("key: %s value: %s\n", key, value);
+ 
+    printf("range route.eu to route.eu-west.2 count: %d\n",
+           parmFindRange( handle, "route.eu", "route.eu-west.2", &iter));
+    while( (type = parmIterNext( &iter, &key, &value)) != PRMP_END ) {
+        printf("Type: %d key: %s\n", type, key);
+        if( type == PRMP_NEXTLEVEL && parmLevelDown( handle ) == 0 ) {
+            printNodes( handle );
+            parmLevelUp( handle );
+        }
+    }
+ 
+    printf("file order still: ");
+    parmSetBegin( handle );
+    while( parmGetNext( handle, &key, &value) != PRMP_END )
+        printf("%s ", key);
+    printf("\n");
+ 
+    parmFree( handle );
+}
+ 
+ 
+//-----------------------------------------------------------------------------
+// Feed a document a few bytes at a time, cutting through keys, quotes and
+// escapes, and then a broken one to see the parser is still good after...
+//-----------------------------------------------------------------------------
+void testFeed(void)
+{
+    static char parms[] =
+        "outer: {\r\n"
+        "   inner: { deep: \"quoted \\\"value\\\" here\" }\r\n"
+        "   empty: { }\r\n"
+        "}\r\n"
+        "# comment cut in pieces\n"
+        "last: ${HOME}x";
+    void* parser;
+    void* handle;
+    int   len = (int) sizeof(parms) - 1;
+    int   rc;
+    int   i;
+    int   n;
+ 
+    parmParserCreate( &parser );
+ 
+    for( i = 0; i < len; i += n ) {
+        n = (i % 3) + 1;
+        if( i + n > len )
+            n = len - i;
+        parmFeed( parser, parms + i, n );
+    }
+ 
+    rc = parmFinish( parser, &handle );
+    printf("rc from parmFinish: %d\n", rc);
+    if( rc == 0 ) {
+        printNodes( handle );
+        parmFree( handle );
+    }
+ 
+    parmFeed( parser, "bad: { a: 1 ", 12 );
+    printf("rc from parmFinish: %d\n", parmFinish( parser, &handle ));
+ 
+    parmFeed( parser, "good: yes", 9 );
+    rc = parmFinish( parser, &handle );
+    printf("rc from parmFinish: %d\n", rc);
+    if( rc == 0 ) {
+        printNodes( handle );
+        parmFree( handle );
+    }
+ 
+    parmParserDestroy( parser );
+}
+ 
+ 
+//-----------------------------------------------------------------------------
+// Print the errors the last parse with a context or parser found...
+//-----------------------------------------------------------------------------
+void printErrors(void* ctx)
+{
+    PRMP_ERROR error;
+    int   count;
+    int   i;
+ 
+    count = parmGetError( ctx, 0, NULL );
+    for( i = 0; i < count; i++ ) {
+        parmGetError( ctx, i, &error );
+        printf("error %d at line %d column %d offset %ld, expected %s\n", error.code,
+               error.line, error.column, error.offset, error.expected ? error.expected : "-");
+    }
+}
+ 
+ 
+//-----------------------------------------------------------------------------
+// Collect all the errors in one pass with recovery, then just the first...
+//-----------------------------------------------------------------------------
+void testErrors(void)
+{
+    static char parms[] =
+        "good: 1\n"
+        "missing colon\n"
+        "level: {\n"
+        "   a: 1 b\n"
+        "   c: }\n"
+        "after: 2\n"
+        "bad\"quote: x\n"
+        "open: {\n";
+    PRMP_READER reader;
+    void* ctx;
+    void* handle;
+    int   rc;
+ 
+    parmContextCreate( &ctx );
+    parmSetRecovery( ctx, 10 );
+ 
+    parmReaderMemory( &reader, parms, sizeof(parms) - 1 );
+    rc = parmParseSourceWith( ctx, &handle, &reader );
+    parmReaderClose( &reader );
+    printf("rc from parmParseSourceWith: %d\n", rc);
+    printErrors( ctx );
+ 
+    parmSetRecovery( ctx, 0 );
+ 
+    parmReaderMemory( &reader, parms, sizeof(parms) - 1 );
+    rc = parmParseSourceWith( ctx, &handle, &reader );
+    parmReaderClose( &reader );
+    printf("rc from parmParseSourceWith: %d\n", rc);
+    printErrors( ctx );
+ 
+    parmContextDestroy( ctx );
+}
+ 
+ 
+//-----------------------------------------------------------------------------
+// Export the download blocks as a table, then the upload block the cursor
+// is on...
+//-----------------------------------------------------------------------------
+void testExport(void* handle)
+{
+    PRMP_EXPORT* table;
+    PRMP_EXPORT_ENTRY* e;
+    char* value;
+    int   rc;
+    int   i;
+ 
+    rc = parmExport( handle, "download", 0, &table );
+    printf("rc from parmExport: %d\n", rc);
+    if( rc >= 0 ) {
+        for( i = 0; i < table->count; i++ ) {
+            e = &table->entries[i];
+            printf("%d: depth %d parent %d path: %s value: %s\n", i, e->depth, e->parent,
+                   e->path, e->value ? e->value : "-");
+        }
+        parmFreeExport( table );
+    }
+ 
+    parmSetBegin( handle );
+    parmFindKey( handle, "upload", &value );
+    rc = parmExport( handle, NULL, PRMP_EXPORT_NOPATH, &table );
+    printf("rc from parmExport: %d\n", rc);
+    if( rc >= 0 ) {
+        for( i = 0; i < table->count; i++ ) {
+            e = &table->entries[i];
+            printf("%d: depth %d parent %d key: %s value: %s\n", i, e->depth, e->parent,
+                   e->key, e->value ? e->value : "-");
+        }
+        parmFreeExport( table );
+    }
+}
+ 
+ 
+//-----------------------------------------------------------------------------
+// Publish parameters in shared memory and attach to them...
+//-----------------------------------------------------------------------------
+void testShared(void* handle)
+{
+    static char parms[] =
+        "home: ${PARM_TEST_USER}\n"
+        "route.b: 2\n"
+        "route.a: 1\n"
+        "loop: ${loop}\n";
+    PRMP_READER reader;
+    PRMP_ITER iter;
+    void* local;
+    void* shared;
+    char  name[64];
+    char* key;
+    char* value;
+    int   rc;
+ 
+    snprintf( name, sizeof(name), "parmtest.%d", (int) getpid());
+ 
+    rc = parmPublishShared( handle, name );
+    printf("generation from parmPublishShared: %d\n", rc);
+ 
+    rc = parmAttachShared( &shared, name );
+    printf("generation from parmAttachShared: %d\n", rc);
+    if( rc > 0 ) {
+        parmSetBegin( shared );
+        printNodes( shared );
+        parmFree( shared );
+    }
+ 
+    // Publish a new generation and switch over to it...
+    parmReaderMemory( &reader, parms, sizeof(parms) - 1 );
+    rc = parmParseSource( &local, &reader );
+    parmReaderClose( &reader );
+    if( rc == 0 ) {
+        printf("generation from parmPublishShared: %d\n", parmPublishShared( local, name ));
+        parmFree( local );
+    }
+ 
+    printf("current generation: %d\n", parmSharedGeneration( name ));
+    if( parmAttachShared( &shared, name ) > 0 ) {
+        parmFindKey( shared, "home", &value);
+        printf("home: %s\n", value);
+        printf("loop. Type: %d\n", parmFindKey( shared, "loop", &value));
+        parmFindPrefix( shared, "route.", &iter);
+        while( parmIterNext( &iter, &key, &value) != PRMP_END )
+            printf("key: %s value: %s\n", key, value);
+        parmFree( shared );
+    }
+ 
+    parmRemoveShared( name );
+}
+ 
+ 
 //-----------------------------------------------------------------------------
 //
 //-----------------------------------------------------------------------------
@@ -95,6 +451,32 @@ int  main(int argc, char* argv[])
     printf("Try to find specific nodes...\n");
     testSearchNodes( handle );
  
+    printf("Parse from a memory source...\n");
+    testMemorySource();
+ 
+    printf("Parse with a parse context...\n");
+    testContext();
+ 
+    printf("Decode escapes and references...\n");
+    testDecoding();
+ 
+    printf("Find by prefix and range...\n");
+    testPrefixRange();
+ 
+    printf("Feed a parser in pieces...\n");
+    testFeed();
+ 
+    printf("Report parse errors...\n");
+    testErrors();
+ 
+    printf("Export to a table...\n");
+    testExport( handle );
+ 
+    printf("Share parameters between processes...\n");
+    testShared( handle );
+ 
+    parmFree( handle );
+ 
     return 0;
 }
  
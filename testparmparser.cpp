@@ -0,0 +1,139 @@
+//-----------------------------------------------------------------------------
+//  testprmp (C++) -- Test the C++ API in parmparser.hpp...
+//
+//  g++ -std=c++17 testparmparser.cpp parmparser.o -lpthread
+//
+//-----------------------------------------------------------------------------
+#include <stdio.h>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "parmparser.hpp"   // C++ API over the parameter parsing routines.
+
+
+// Level iterators are forward iterators, so <algorithm> can use them...
+static_assert( std::is_same<std::iterator_traits<parm::Level::iterator>::iterator_category,
+                            std::forward_iterator_tag>::value, "forward iterator");
+static_assert( std::is_default_constructible<parm::Level::iterator>::value &&
+               std::is_copy_constructible<parm::Level::iterator>::value, "forward iterator");
+static_assert( !std::is_copy_constructible<parm::Document>::value &&
+               std::is_nothrow_move_constructible<parm::Document>::value, "move-only document");
+
+
+static std::string str(std::string_view sv)
+{
+    return std::string(sv);
+}
+
+
+//-----------------------------------------------------------------------------
+// Walk a level with range-for, going down into the levels under it...
+//-----------------------------------------------------------------------------
+static void printLevel(const parm::Level& level, int depth)
+{
+    for( auto& entry : level ) {
+        if( entry.isLevel() ) {
+            printf("%*sKey: %s -- Going down a level\n", depth * 3, "", str(entry.key()).c_str());
+            printLevel( entry.level(), depth + 1 );
+            printf("%*sGoing up a level\n", depth * 3, "");
+        } else {
+            printf("%*skey: %s value: %s\n", depth * 3, "", str(entry.key()).c_str(),
+                   str(entry.value()).c_str());
+        }
+    }
+}
+
+
+//-----------------------------------------------------------------------------
+// Find keys, all the entries with one key, and use <algorithm>...
+//-----------------------------------------------------------------------------
+static void testFind(const parm::Document& doc)
+{
+    parm::Level root = doc.root();
+
+    auto it = root.find("upload");
+    printf("find upload: %s, to: %s\n", it != root.end() ? "found" : "not found",
+           str(it->level().find("to")->value()).c_str());
+    printf("find nothing: %s\n", root.find("nothing") == root.end() ? "not found" : "found");
+
+    for( auto& dl : root.equal_range("download") )
+        printf("download from: %s\n", str(dl.level().find("from")->value()).c_str());
+
+    printf("levels: %d\n", (int) std::count_if( root.begin(), root.end(),
+                                                [](const parm::Entry& e) { return e.isLevel(); }));
+    printf("entries: %d\n", (int) std::distance( root.begin(), root.end()));
+
+    auto first = std::find_if( root.begin(), root.end(),
+                               [](const parm::Entry& e) { return e.key() == "password"; });
+    printf("find_if password: %s\n", str(first->value()).c_str());
+}
+
+
+//-----------------------------------------------------------------------------
+// Values with escapes and ${} references come back decoded...
+//-----------------------------------------------------------------------------
+static void testDecoding()
+{
+    static char parms[] =
+        "host: example.com\n"
+        "url: \"http://${host}/\\x41\\tpath\"\n";
+    PRMP_READER reader;
+    parm::Document doc;
+
+    parmReaderMemory( &reader, parms, sizeof(parms) - 1 );
+    printf("rc from parse: %d\n", doc.parse( reader ));
+    parmReaderClose( &reader );
+
+    printf("url: [%s]\n", str(doc.root().find("url")->value()).c_str());
+}
+
+
+//-----------------------------------------------------------------------------
+// A document can be moved, leaving the old one empty...
+//-----------------------------------------------------------------------------
+static void testMove(parm::Document& doc)
+{
+    parm::Document moved = std::move( doc );
+    printf("after move: old %s, new %s\n", doc ? "has parameters" : "empty",
+           moved ? "has parameters" : "empty");
+
+    parm::Document assigned;
+    assigned = std::move( moved );
+    printf("after move assignment: old %s, new %s, email: %s\n", moved ? "has parameters" : "empty",
+           assigned ? "has parameters" : "empty",
+           str(assigned.root().find("email")->value()).c_str());
+}
+
+
+//-----------------------------------------------------------------------------
+//
+//-----------------------------------------------------------------------------
+int  main()
+{
+    parm::Document doc;
+    int rc;
+
+    rc = doc.parseFile( "testprms.ini" );
+
+    printf("rc from parseFile: %d\n", rc);
+    if( rc != 0 )
+        return 1;
+
+    printf("Traverse levels...\n");
+    printLevel( doc.root(), 0 );
+
+    printf("Find entries...\n");
+    testFind( doc );
+
+    printf("Decode values...\n");
+    testDecoding();
+
+    printf("Move documents...\n");
+    testMove( doc );
+
+    return 0;
+}